@@ -0,0 +1,312 @@
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <IRM.hpp>
+
+#ifndef COMPRESSED_IRM_HPP
+#define COMPRESSED_IRM_HPP
+
+// Read-only IRM with compressed buckets. The segments are stored once; each
+// bucket keeps its intervals sorted by start in blocks of BLOCK, where an
+// interval is a 16 bit start offset from the block's first start and a 16
+// bit width, both in units of the block's quantum, plus a 32 bit segment
+// id. That is about 8 bytes per interval instead of a tree node share, an
+// interval and a pointer. Quantization only ever widens intervals, so the
+// exact test still sees every intersected segment. A stab binary searches
+// the running maximum of the blocks' largest stops for the first block that
+// can reach it, skips the blocks whose own largest stop falls short and
+// decodes the others 8 intervals at a time with SSE2 where available.
+class CompressedIRM
+{
+public:
+
+    static const unsigned int BLOCK = 64;
+
+    struct Block
+    {
+        // First start, size of one quantization step, largest stop
+        float base, quantum, maxStop;
+        uint32_t count;
+
+        uint16_t start[BLOCK], width[BLOCK];
+        uint32_t id[BLOCK];
+    };
+
+    struct Stats
+    {
+        size_t intervals, blocks;
+        size_t blockBytes, segmentBytes;
+
+        inline size_t bytes() const
+        {
+            return blockBytes + segmentBytes;
+        }
+    };
+
+    CompressedIRM(unsigned int k, const std::vector<segment>& s) :
+        k(k), scale((float)((double)(k) / scalar_traits<double>::pi())), segments(s), t(k)
+    {
+        assert(k != 0);
+
+        resetCounters();
+
+        const std::vector<BucketBound<float>> bounds = bucketBounds<float>(k);
+
+        std::vector<Entry> entries;
+        for(unsigned int i = 0; i < k; i++)
+        {
+            entries.clear();
+            entries.reserve(segments.size());
+
+            for(size_t u = 0; u < segments.size(); u++)
+            {
+                vec2 a = projectedRange(bounds[i], bounds[i + 1], segments[u].a);
+                vec2 b = projectedRange(bounds[i], bounds[i + 1], segments[u].b);
+
+                Entry e = { std::min(a.x, b.x), std::max(a.y, b.y), (uint32_t)(u) };
+                entries.push_back(e);
+            }
+
+            std::sort(entries.begin(), entries.end(), [](const Entry& x, const Entry& y) { return x.start < y.start; });
+            encode(entries, t[i]);
+        }
+    }
+
+    // Indexed segments, in the order given
+    inline size_t count() const
+    {
+        return segments.size();
+    }
+
+    inline const segment& at(size_t id) const
+    {
+        return segments[id];
+    }
+
+    inline unsigned int buckets() const
+    {
+        return k;
+    }
+
+    inline const std::vector<QueryCounters>& counters() const
+    {
+        return probes;
+    }
+
+    inline void resetCounters()
+    {
+        probes.assign(k, QueryCounters());
+    }
+
+    Stats statistics() const
+    {
+        Stats res = Stats();
+        res.segmentBytes = sizeof(segment) * segments.capacity();
+
+        for(const Bucket& b : t)
+        {
+            res.blocks += b.blocks.size();
+            res.blockBytes += sizeof(Block) * b.blocks.capacity() + sizeof(float) * b.reach.capacity() + sizeof(Bucket);
+
+            for(const Block& x : b.blocks)
+                res.intervals += x.count;
+        }
+
+        return res;
+    }
+
+    size_t querySize(const line& l)
+    {
+        size_t res = 0;
+        visit(l, [&](uint32_t) { res++; });
+        return res;
+    }
+
+    // Ids of the intersected segments
+    std::vector<uint32_t> query(const line& l)
+    {
+        std::vector<uint32_t> res;
+        visit(l, [&](uint32_t id) { res.push_back(id); });
+        return res;
+    }
+
+private:
+
+    struct Entry
+    {
+        float start, stop;
+        uint32_t id;
+    };
+
+    struct Bucket
+    {
+        std::vector<Block> blocks;
+
+        // Largest maxStop of the blocks up to and including each one
+        std::vector<float> reach;
+    };
+
+    static const uint32_t MAX_CODE = 65535;
+
+    // Steps per block range, a little under MAX_CODE so rounding in the
+    // decoder can't push a width past it
+    static const uint32_t STEPS = 65000;
+
+    // The decoder's arithmetic, also used when encoding so decoded
+    // intervals are guaranteed to contain the original ones
+    static inline float decodeStart(const Block& b, uint32_t code)
+    {
+        return b.base + (float)(code) * b.quantum;
+    }
+
+    static inline float decodeStop(const Block& b, float start, uint32_t code)
+    {
+        return start + (float)(code) * b.quantum;
+    }
+
+    static void encode(const std::vector<Entry>& entries, Bucket& bucket)
+    {
+        bucket.blocks.resize((entries.size() + BLOCK - 1) / BLOCK);
+        bucket.reach.resize(bucket.blocks.size());
+
+        for(size_t n = 0; n < bucket.blocks.size(); n++)
+        {
+            Block& b = bucket.blocks[n];
+            const size_t first = n * BLOCK;
+            const size_t last = std::min(first + BLOCK, entries.size());
+
+            b.base = entries[first].start;
+            b.maxStop = b.base;
+            for(size_t u = first; u < last; u++)
+                b.maxStop = std::max(b.maxStop, entries[u].stop);
+
+            bucket.reach[n] = n == 0 ? b.maxStop : std::max(bucket.reach[n - 1], b.maxStop);
+
+            b.quantum = (float)(((double)(b.maxStop) - (double)(b.base)) / (double)(STEPS));
+            if(!(b.quantum > 0.0F))
+                b.quantum = 1.0F;
+            b.count = (uint32_t)(last - first);
+
+            for(size_t u = first; u < BLOCK + first; u++)
+            {
+                const size_t j = u - first;
+
+                // Padding never reaches the exact test, see visit
+                if(u >= last)
+                {
+                    b.start[j] = 0;
+                    b.width[j] = 0;
+                    b.id[j] = 0;
+                    continue;
+                }
+
+                const Entry& e = entries[u];
+
+                uint32_t s = (uint32_t)(std::min(std::floor(((double)(e.start) - (double)(b.base)) / (double)(b.quantum)), (double)(MAX_CODE)));
+                while(s > 0 && decodeStart(b, s) > e.start)
+                    s--;
+
+                const float start = decodeStart(b, s);
+                uint32_t w = (uint32_t)(std::min(std::ceil(((double)(e.stop) - (double)(start)) / (double)(b.quantum)), (double)(MAX_CODE)));
+                while(w < MAX_CODE && decodeStop(b, start, w) < e.stop)
+                    w++;
+
+                b.start[j] = (uint16_t)(s);
+                b.width[j] = (uint16_t)(w);
+                b.id[j] = e.id;
+            }
+        }
+    }
+
+    // Bit j of the result is set when decoded interval first + j of b
+    // overlaps [lo, hi], for 8 intervals
+    static inline unsigned int overlaps(const Block& b, unsigned int first, float lo, float hi)
+    {
+#ifdef IRM_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i s16 = _mm_loadu_si128((const __m128i*)(b.start + first));
+        const __m128i w16 = _mm_loadu_si128((const __m128i*)(b.width + first));
+
+        const __m128 base = _mm_set1_ps(b.base), quantum = _mm_set1_ps(b.quantum);
+        const __m128 vlo = _mm_set1_ps(lo), vhi = _mm_set1_ps(hi);
+
+        __m128 s = _mm_add_ps(base, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(s16, zero)), quantum));
+        __m128 e = _mm_add_ps(s, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(w16, zero)), quantum));
+        unsigned int res = (unsigned int)(_mm_movemask_ps(_mm_and_ps(_mm_cmple_ps(s, vhi), _mm_cmpge_ps(e, vlo))));
+
+        s = _mm_add_ps(base, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(s16, zero)), quantum));
+        e = _mm_add_ps(s, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(w16, zero)), quantum));
+        res |= (unsigned int)(_mm_movemask_ps(_mm_and_ps(_mm_cmple_ps(s, vhi), _mm_cmpge_ps(e, vlo)))) << 4;
+
+        return res;
+#else
+        unsigned int res = 0;
+        for(unsigned int j = 0; j < 8; j++)
+        {
+            float s = decodeStart(b, b.start[first + j]);
+            float e = decodeStop(b, s, b.width[first + j]);
+            res |= (s <= hi && e >= lo ? 1U : 0U) << j;
+        }
+        return res;
+#endif
+    }
+
+    template <class UnaryFunction>
+    void visit(const line& l, UnaryFunction f)
+    {
+        float angle = IRM::lineToTransformAngle(l);
+        float x = IRM::transformLine(l);
+        unsigned int n = std::min((unsigned int)(std::floor(angle * scale)), k - 1);
+        IRM_PROBE(n);
+
+        const Bucket& bucket = t[n];
+        const float lo = x - EPSILON, hi = x + EPSILON;
+
+        // No block before the first whose running maximum reaches lo holds
+        // an interval overlapping [lo, hi]
+        auto it = bucket.blocks.begin() + (std::lower_bound(bucket.reach.begin(), bucket.reach.end(), lo) - bucket.reach.begin());
+
+        vec2 tmp;
+        for(; it != bucket.blocks.end() && it->base <= hi; ++it)
+        {
+            const Block& b = *it;
+            if(b.maxStop < lo)
+                continue;
+
+            IRM_COUNT(scanned, b.count);
+
+            for(unsigned int first = 0; first < b.count; first += 8)
+            {
+                unsigned int mask = overlaps(b, first, lo, hi);
+                if(b.count - first < 8)
+                    mask &= (1U << (b.count - first)) - 1U;
+
+                for(unsigned int j = 0; mask != 0; j++, mask >>= 1)
+                {
+                    if(!(mask & 1U))
+                        continue;
+
+                    IRM_COUNT(candidates, 1);
+                    const uint32_t id = b.id[first + j];
+                    if(l.intersect(segments[id], tmp))
+                    {
+                        IRM_COUNT(hits, 1);
+                        f(id);
+                    }
+                }
+            }
+        }
+    }
+
+    unsigned int k;
+    float scale;
+
+    std::vector<segment> segments;
+    std::vector<Bucket> t;
+
+    std::vector<QueryCounters> probes;
+};
+
+#endif // COMPRESSED_IRM_HPP
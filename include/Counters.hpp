@@ -0,0 +1,134 @@
+#include <ostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <atomic>
+
+#ifndef COUNTERS_HPP
+#define COUNTERS_HPP
+
+// A counter any number of query threads may add to. Increments are relaxed
+// atomics: totals are exact once the queries are done, nothing is ordered
+// by them. Copies take a snapshot.
+class Counter
+{
+public:
+
+    Counter(uint64_t v = 0) : value(v) {}
+
+    Counter(const Counter& o) : value(o.load()) {}
+
+    Counter& operator=(const Counter& o)
+    {
+        value.store(o.load(), std::memory_order_relaxed);
+        return *this;
+    }
+
+    Counter& operator+=(uint64_t n)
+    {
+        value.fetch_add(n, std::memory_order_relaxed);
+        return *this;
+    }
+
+    inline uint64_t load() const
+    {
+        return value.load(std::memory_order_relaxed);
+    }
+
+    inline operator uint64_t() const
+    {
+        return load();
+    }
+
+private:
+
+    std::atomic<uint64_t> value;
+};
+
+// Hot path counters for IRM queries. They are only collected when the tree
+// is built with IRM_INSTRUMENT defined; otherwise IRM_COUNT expands to
+// nothing and the query code is unchanged. Concurrent queries of the same
+// bucket share its counters.
+struct QueryCounters
+{
+    QueryCounters() : queries(0), nodes(0), scanned(0), candidates(0), hits(0), fallbacks(0), scans(0) {}
+
+    // Tree nodes entered, intervals looked at, intervals passed on to
+    // line::intersect and intersections confirmed by it
+    Counter queries, nodes, scanned, candidates, hits;
+
+    // End points the filtered predicate had to classify exactly
+    Counter fallbacks;
+
+    // Queries answered by scanning a flat bucket instead of its tree
+    Counter scans;
+
+    QueryCounters& operator+=(const QueryCounters& o)
+    {
+        queries += o.queries;
+        nodes += o.nodes;
+        scanned += o.scanned;
+        candidates += o.candidates;
+        hits += o.hits;
+        fallbacks += o.fallbacks;
+        scans += o.scans;
+        return *this;
+    }
+
+    // Share of candidates rejected by the exact test
+    double falsePositiveRate() const
+    {
+        const uint64_t c = candidates, h = hits;
+        return c == 0 ? 0.0 : (double)(c - h) / (double)(c);
+    }
+
+    // Counters the running query on this thread reports to, if any
+    static QueryCounters*& active()
+    {
+        static thread_local QueryCounters* c = nullptr;
+        return c;
+    }
+};
+
+// Points the counters of the current thread at c for the enclosing scope
+struct CounterScope
+{
+    CounterScope(QueryCounters* c) : previous(QueryCounters::active())
+    {
+        QueryCounters::active() = c;
+    }
+
+    ~CounterScope()
+    {
+        QueryCounters::active() = previous;
+    }
+
+    QueryCounters* previous;
+};
+
+#ifdef IRM_INSTRUMENT
+#define IRM_COUNT(field, n) do { if(QueryCounters::active()) QueryCounters::active()->field += (uint64_t)(n); } while(0)
+#else
+#define IRM_COUNT(field, n) do { } while(0)
+#endif
+
+// One row per bucket, prefixed by the given label columns
+static inline void writeCountersCSV(std::ostream& o, const std::vector<QueryCounters>& c, const std::string& labels = "")
+{
+    for(size_t i = 0; i < c.size(); i++)
+        o << labels << i << ',' << c[i].queries << ',' << c[i].nodes << ',' << c[i].scanned << ',' << c[i].candidates << ',' << c[i].hits << ',' << c[i].fallbacks << ',' << c[i].scans << ',' << c[i].falsePositiveRate() << '\n';
+}
+
+static inline void writeCountersJSON(std::ostream& o, const std::vector<QueryCounters>& c)
+{
+    o << '[';
+    for(size_t i = 0; i < c.size(); i++)
+    {
+        o << (i == 0 ? "" : ",") << "{\"bucket\":" << i << ",\"queries\":" << c[i].queries << ",\"nodes\":" << c[i].nodes << ",\"scanned\":" << c[i].scanned <<
+             ",\"candidates\":" << c[i].candidates << ",\"hits\":" << c[i].hits << ",\"fallbacks\":" << c[i].fallbacks <<
+             ",\"scans\":" << c[i].scans << '}';
+    }
+    o << ']';
+}
+
+#endif // COUNTERS_HPP
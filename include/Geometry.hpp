@@ -6,72 +6,124 @@
 
 #define SQUARE(V) ((V) * (V))
 
-static const float INF = 1e+8F;
-static const float EPSILON = 1e-5F;
-static const float PI = 3.14159265358979323846F;
+// Tolerances and constants per coordinate type. The generic values are the
+// ones float builds always used; double tightens the tolerance so large
+// coordinates (e.g. projected GIS scenes) keep their precision.
+template <class T>
+struct scalar_traits
+{
+    static constexpr T inf() { return (T)(1e+8); }
+    static constexpr T epsilon() { return (T)(1e-5); }
+    static constexpr T pi() { return (T)(3.14159265358979323846); }
+};
+
+template <>
+struct scalar_traits<double>
+{
+    static constexpr double inf() { return 1e+15; }
+    static constexpr double epsilon() { return 1e-9; }
+    static constexpr double pi() { return 3.14159265358979323846; }
+};
+
+static const float INF = scalar_traits<float>::inf();
+static const float EPSILON = scalar_traits<float>::epsilon();
+static const float PI = scalar_traits<float>::pi();
 
-static inline bool eqf(float a, float b, float tolerance = EPSILON)
+template <class T>
+static inline bool eqf(T a, T b, T tolerance = scalar_traits<T>::epsilon())
 {
     return std::fabs(a - b) <= tolerance;
 }
 
-struct vec2
+template <class T>
+struct basic_vec2
 {
-    vec2() : x(0.0F), y(0.0F) {}
-    vec2(float x, float y) : x(x), y(y) {}
+    basic_vec2() : x(0), y(0) {}
+    basic_vec2(T x, T y) : x(x), y(y) {}
 
-    float x, y;
-
-    void operator=(const vec2& v)
-    {
-        x = v.x;
-        y = v.y;
-    }
+    T x, y;
 };
 
-std::ostream& operator<<(std::ostream& o, const vec2& v)
+typedef basic_vec2<float> vec2;
+
+template <class T>
+inline std::ostream& operator<<(std::ostream& o, const basic_vec2<T>& v)
 {
     o << '(' << v.x << ", " << v.y << ')';
     return o;
 }
 
-struct segment
+// A segment optionally carries a caller defined payload (an ID, a handle...)
+// stored next to its end points. Without one (P = void) it is just the two
+// points, as before.
+template <class T, class P = void>
+struct basic_segment
 {
-    vec2 a, b;
+    typedef T scalar_type;
+    typedef P payload_type;
 
-    segment(vec2 a, vec2 b) : a(a), b(b) {}
+    basic_vec2<T> a, b;
+    P payload;
 
-    void operator=(const segment& v)
-    {
-        a = v.a;
-        b = v.b;
-    }
+    basic_segment(basic_vec2<T> a, basic_vec2<T> b, P payload = P()) : a(a), b(b), payload(payload) {}
 };
 
-std::ostream& operator<<(std::ostream& o, const segment& v)
+template <class T>
+struct basic_segment<T, void>
+{
+    typedef T scalar_type;
+    typedef void payload_type;
+
+    basic_vec2<T> a, b;
+
+    basic_segment(basic_vec2<T> a, basic_vec2<T> b) : a(a), b(b) {}
+};
+
+typedef basic_segment<float> segment;
+
+template <class T, class P>
+inline std::ostream& operator<<(std::ostream& o, const basic_segment<T, P>& v)
 {
     o << v.a << " -> " << v.b;
     return o;
 }
 
-struct line
+template <class T>
+struct basic_line
 {
-    float slope, offset;
+    typedef T scalar_type;
+    typedef basic_vec2<T> vector_type;
+
+    T slope, offset;
 
-    line(float slope, float offset) : slope(slope), offset(offset) {}
+    basic_line(T slope, T offset) : slope(slope), offset(offset) {}
 
-    bool intersect(const segment& s, vec2& point) const
+    template <class P>
+    bool intersect(const basic_segment<T, P>& s, basic_vec2<T>& point) const
     {
-        float m = eqf(s.a.x, s.b.x) ? (s.a.y > s.b.y ? INF : -INF) : (s.a.y - s.b.y) / (s.a.x - s.b.x);
+        if(eqf(s.a.x, s.b.x))
+        {
+            // Vertical: solving against a slope of INF loses the y range to
+            // rounding, so test the line's height at the segment directly
+            T y = slope * s.a.x + offset;
+            if(std::min(s.a.y, s.b.y) <= y && y <= std::max(s.a.y, s.b.y))
+            {
+                point = basic_vec2<T>(s.a.x, y);
+                return true;
+            }
+            return false;
+        }
+
+        T m = (s.a.y - s.b.y) / (s.a.x - s.b.x);
 
         if(!eqf(slope, m))
         {
-            float b = s.a.y - (m * s.a.x);
-            float x = (offset - b) / (m - slope);
+            T b = s.a.y - (m * s.a.x);
+            T x = (offset - b) / (m - slope);
 
             if(std::min(s.a.x, s.b.x) <= x && x <= std::max(s.a.x, s.b.x))
             {
-                point = vec2(x, slope * x + offset);
+                point = basic_vec2<T>(x, slope * x + offset);
                 return true;
             }
         }
@@ -79,34 +131,43 @@ struct line
         return false;
     }
 
-    vec2 closest() const
+    basic_vec2<T> closest() const
     {
-        float x = (-offset * slope) / (SQUARE(slope) + 1);
-        return vec2(x, slope * x + offset);
+        T x = (-offset * slope) / (SQUARE(slope) + 1);
+        return basic_vec2<T>(x, slope * x + offset);
     }
 
-    float toAngle() const
+    T toAngle() const
     {
-        vec2 c = closest();
-        float s = std::atan2(c.y, c.x);
+        basic_vec2<T> c = closest();
+        T s = std::atan2(c.y, c.x);
 
         return s;
     }
 
 };
 
-std::ostream& operator<<(std::ostream& o, const line& v)
+typedef basic_line<float> line;
+
+template <class T>
+inline std::ostream& operator<<(std::ostream& o, const basic_line<T>& v)
 {
-    o << "y = " << v.slope << "x" << (v.offset < 0.0F ? " - " : " + ") << (v.offset < 0.0F ? -v.offset :  + v.offset);
+    o << "y = " << v.slope << "x" << (v.offset < 0 ? " - " : " + ") << (v.offset < 0 ? -v.offset :  + v.offset);
     return o;
 }
 
+// Rotation by the angle with sine s and cosine c
+template <class T>
+static inline basic_vec2<T> rotate(const basic_vec2<T>& p, T s, T c)
+{
+    return basic_vec2<T>(p.x * c - p.y * s, p.x * s + p.y * c);
+}
+
 // https://stackoverflow.com/a/2259502
-static vec2 rotate(const vec2& p, float angle)
+template <class T>
+static inline basic_vec2<T> rotate(const basic_vec2<T>& p, T angle)
 {
-    float s = std::sin(angle);
-    float c = std::cos(angle);
-    return vec2(p.x * c - p.y * s, p.x * s + p.y * c);
+    return rotate(p, std::sin(angle), std::cos(angle));
 }
 
 #endif // GEOMETRY_HPP
@@ -1,123 +1,1778 @@
 #include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <atomic>
+#include <limits>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <array>
 
 #include <Geometry.hpp>
 #include <Utility.hpp>
 
 #include <IntervalTree.hpp>
+#include <Predicates.hpp>
 
-class IRM
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IRM_SSE2 1
+#endif
+
+#ifndef IRM_HPP
+#define IRM_HPP
+
+// Attributes the counters of the running query to bucket n
+#ifdef IRM_INSTRUMENT
+#define IRM_PROBE(n) CounterScope scope(&probes[n]); IRM_COUNT(queries, 1)
+#else
+#define IRM_PROBE(n) do { } while(0)
+#endif
+
+// Unindexed staging area for recently inserted segments. The geometry is kept
+// as-is for merging and query results, and the slope, offset and x range that
+// line::intersect derives from it are precomputed into flat arrays so the
+// scan is a tight, branch-free loop over contiguous memory. Vertical segments
+// get a NaN slope, which fails every comparison of the loop, and are tested
+// separately.
+template <class Scalar, class Payload = void>
+class SegmentBuffer
+{
+public:
+
+    typedef basic_segment<Scalar, Payload> segment_type;
+    typedef basic_line<Scalar> line_type;
+
+    inline size_t size() const
+    {
+        return segments.size();
+    }
+
+    inline bool empty() const
+    {
+        return segments.empty();
+    }
+
+    inline size_t bytes() const
+    {
+        return sizeof(segment_type) * segments.capacity() + sizeof(Scalar) * (m.capacity() + b.capacity() + xmin.capacity() + xmax.capacity()) +
+               sizeof(size_t) * vertical.capacity();
+    }
+
+    inline const segment_type& at(size_t i) const
+    {
+        return segments[i];
+    }
+
+    void push(const segment_type& s)
+    {
+        segments.push_back(s);
+        m.push_back(0);
+        b.push_back(0);
+        xmin.push_back(0);
+        xmax.push_back(0);
+        set(segments.size() - 1, s);
+    }
+
+    void set(size_t i, const segment_type& s)
+    {
+        bool wasVertical = std::isnan(m[i]);
+        bool isVertical = eqf(s.a.x, s.b.x);
+
+        Scalar sm = isVertical ? std::numeric_limits<Scalar>::quiet_NaN() : (s.a.y - s.b.y) / (s.a.x - s.b.x);
+
+        segments[i] = s;
+        m[i] = sm;
+        b[i] = s.a.y - (sm * s.a.x);
+        xmin[i] = std::min(s.a.x, s.b.x);
+        xmax[i] = std::max(s.a.x, s.b.x);
+
+        if(isVertical && !wasVertical)
+            vertical.push_back(i);
+        else if(wasVertical && !isVertical)
+            vertical.erase(std::find(vertical.begin(), vertical.end(), i));
+    }
+
+    void erase(size_t i)
+    {
+        segments.erase(segments.begin() + i);
+        m.erase(m.begin() + i);
+        b.erase(b.begin() + i);
+        xmin.erase(xmin.begin() + i);
+        xmax.erase(xmax.begin() + i);
+
+        vertical.erase(std::remove(vertical.begin(), vertical.end(), i), vertical.end());
+        for(size_t& v : vertical)
+            v -= v > i ? 1 : 0;
+    }
+
+    void clear()
+    {
+        segments.clear();
+        m.clear();
+        b.clear();
+        xmin.clear();
+        xmax.clear();
+        vertical.clear();
+    }
+
+    // Same arithmetic as line::intersect, so results match the indexed path
+    size_t countIntersect(const line_type& l) const
+    {
+        const size_t len = segments.size();
+        const Scalar* pm = m.data();
+        const Scalar* pb = b.data();
+        const Scalar* plo = xmin.data();
+        const Scalar* phi = xmax.data();
+
+        size_t res = 0;
+        for(size_t i = 0; i < len; i++)
+        {
+            Scalar x = (l.offset - pb[i]) / (pm[i] - l.slope);
+            res += (!eqf(l.slope, pm[i]) & (plo[i] <= x) & (x <= phi[i])) ? 1 : 0;
+        }
+
+        basic_vec2<Scalar> tmp;
+        for(size_t v : vertical)
+            res += l.intersect(segments[v], tmp) ? 1 : 0;
+
+        IRM_COUNT(scanned, len);
+        IRM_COUNT(candidates, len);
+        IRM_COUNT(hits, res);
+        return res;
+    }
+
+    template <class UnaryFunction>
+    void visitIntersect(const line_type& l, UnaryFunction f) const
+    {
+        IRM_COUNT(scanned, segments.size());
+        IRM_COUNT(candidates, segments.size());
+
+        basic_vec2<Scalar> tmp;
+        for(size_t i = 0; i < segments.size(); i++)
+        {
+            Scalar x = (l.offset - b[i]) / (m[i] - l.slope);
+            bool hit = std::isnan(m[i]) ? l.intersect(segments[i], tmp) : (!eqf(l.slope, m[i]) && xmin[i] <= x && x <= xmax[i]);
+            if(hit)
+            {
+                IRM_COUNT(hits, 1);
+                f(segments[i]);
+            }
+        }
+    }
+
+    // Tests every staged segment with l.intersect, for lines such as
+    // robust_line whose test the flat arrays can't reproduce
+    template <class Line, class UnaryFunction>
+    void visitWith(const Line& l, UnaryFunction f) const
+    {
+        IRM_COUNT(scanned, segments.size());
+        IRM_COUNT(candidates, segments.size());
+
+        basic_vec2<Scalar> tmp;
+        for(const segment_type& s : segments)
+        {
+            if(l.intersect(s, tmp))
+            {
+                IRM_COUNT(hits, 1);
+                f(s);
+            }
+        }
+    }
+
+private:
+
+    std::vector<segment_type> segments;
+    std::vector<Scalar> m, b, xmin, xmax;
+
+    // Indices of the vertical segments
+    std::vector<size_t> vertical;
+};
+
+// Sequence of T indexed by handle, in chunks of at most CHUNK elements that
+// copies of the table share. A copy only duplicates the chunk list, and a
+// write to a shared chunk copies that chunk alone, so changing a few handles
+// of a snapshot costs O(N / CHUNK) instead of O(N). Erasing shifts the later
+// handles down like std::vector::erase.
+template <class T>
+class HandleTable
+{
+public:
+
+    static const size_t CHUNK = 512;
+
+    HandleTable() : len(0) {}
+
+    inline size_t size() const
+    {
+        return len;
+    }
+
+    inline bool empty() const
+    {
+        return len == 0;
+    }
+
+    inline size_t bytes() const
+    {
+        size_t res = (sizeof(chunk_ptr) + sizeof(size_t)) * chunks.capacity();
+        for(const chunk_ptr& c : chunks)
+            res += sizeof(T) * c->capacity() + sizeof(*c);
+        return res;
+    }
+
+    inline const T& operator[](size_t h) const
+    {
+        const size_t c = find(h);
+        return (*chunks[c])[h - first[c]];
+    }
+
+    void set(size_t h, const T& v)
+    {
+        const size_t c = find(h);
+        own(c)[h - first[c]] = v;
+    }
+
+    void push_back(const T& v)
+    {
+        if(chunks.empty() || chunks.back()->size() >= CHUNK)
+        {
+            chunks.push_back(std::make_shared<std::vector<T>>());
+            chunks.back()->reserve(CHUNK);
+            first.push_back(len);
+        }
+
+        own(chunks.size() - 1).push_back(v);
+        len++;
+    }
+
+    void erase(size_t h)
+    {
+        const size_t c = find(h);
+        std::vector<T>& chunk = own(c);
+        chunk.erase(chunk.begin() + (h - first[c]));
+        len--;
+
+        for(size_t i = c + 1; i < first.size(); i++)
+            first[i]--;
+
+        // Fold the chunk into a neighbour once both fit in one, so chunks
+        // stay over half full on average
+        if(c + 1 < chunks.size() && chunk.size() + chunks[c + 1]->size() <= CHUNK)
+            fold(c);
+        else if(c > 0 && chunks[c - 1]->size() + chunk.size() <= CHUNK)
+            fold(c - 1);
+    }
+
+    void clear()
+    {
+        chunks.clear();
+        first.clear();
+        len = 0;
+    }
+
+    // Calls f on every element in handle order
+    template <class UnaryFunction>
+    void visit(UnaryFunction f) const
+    {
+        for(const chunk_ptr& c : chunks)
+            for(const T& v : *c)
+                f(v);
+    }
+
+    // First handle whose element is not less than v, like std::lower_bound,
+    // for a table sorted by less
+    template <class U, class Compare>
+    size_t lower_bound(const U& v, Compare less) const
+    {
+        if(len == 0)
+            return 0;
+
+        // Only the sole chunk of an empty table is ever empty
+        auto c = std::partition_point(chunks.begin(), chunks.end(), [&](const chunk_ptr& p) { return less(p->back(), v); });
+        if(c == chunks.end())
+            return len;
+
+        const size_t i = (size_t)(c - chunks.begin());
+        return first[i] + (size_t)(std::lower_bound((*c)->begin(), (*c)->end(), v, less) - (*c)->begin());
+    }
+
+private:
+
+    typedef std::shared_ptr<std::vector<T>> chunk_ptr;
+
+    // Chunk holding handle h
+    inline size_t find(size_t h) const
+    {
+        assert(h < len);
+        return (size_t)(std::upper_bound(first.begin(), first.end(), h) - first.begin()) - 1;
+    }
+
+    // Chunk c, copied first while another table shares it
+    std::vector<T>& own(size_t c)
+    {
+        if(chunks[c].use_count() != 1)
+        {
+            chunk_ptr copy = std::make_shared<std::vector<T>>();
+            copy->reserve(CHUNK);
+            copy->assign(chunks[c]->begin(), chunks[c]->end());
+            chunks[c] = copy;
+        }
+
+        return *chunks[c];
+    }
+
+    // Appends chunk c + 1 to chunk c
+    void fold(size_t c)
+    {
+        const std::vector<T>& next = *chunks[c + 1];
+        std::vector<T>& chunk = own(c);
+        chunk.insert(chunk.end(), next.begin(), next.end());
+
+        chunks.erase(chunks.begin() + (c + 1));
+        first.erase(first.begin() + (c + 1));
+
+        if(chunk.empty())
+        {
+            chunks.erase(chunks.begin() + c);
+            first.erase(first.begin() + c);
+        }
+    }
+
+    std::vector<chunk_ptr> chunks;
+
+    // Handle of the first element of every chunk
+    std::vector<size_t> first;
+    size_t len;
+};
+
+// Bit u of the result is set when interval u of the 16 in ps and pe
+// overlaps [lo, hi]
+template <class Scalar>
+static inline uint32_t overlapMask(const Scalar* ps, const Scalar* pe, Scalar lo, Scalar hi)
+{
+    uint32_t res = 0;
+    for(uint32_t u = 0; u < 16; u++)
+        res |= (uint32_t)((pe[u] >= lo) & (ps[u] <= hi)) << u;
+    return res;
+}
+
+#ifdef IRM_SSE2
+static inline uint32_t overlapMask(const float* ps, const float* pe, float lo, float hi)
+{
+    const __m128 vlo = _mm_set1_ps(lo), vhi = _mm_set1_ps(hi);
+
+    uint32_t res = 0;
+    for(uint32_t u = 0; u < 16; u += 4)
+    {
+        __m128 hit = _mm_and_ps(_mm_cmpge_ps(_mm_loadu_ps(pe + u), vlo), _mm_cmple_ps(_mm_loadu_ps(ps + u), vhi));
+        res |= (uint32_t)(_mm_movemask_ps(hit)) << u;
+    }
+    return res;
+}
+#endif
+
+// The intervals of one bucket in flat arrays, all scanned by every query.
+// For small buckets, or ones whose intervals are so wide that most of them
+// overlap any query, this is cheaper than walking the tree. The overlap
+// test runs branch free over 16 intervals at a time (with SSE2 for float)
+// before the hits among them are passed on. Order is not kept, erase moves
+// the last interval.
+template <class Scalar, class Value>
+class FlatBucket
+{
+public:
+
+    typedef Interval<Scalar, Value> interval;
+
+    template <class Tree>
+    explicit FlatBucket(const Tree& t)
+    {
+        t.visit_all([&](const interval& i) { push(i); });
+    }
+
+    inline size_t size() const
+    {
+        return start.size();
+    }
+
+    inline size_t bytes() const
+    {
+        return sizeof(Scalar) * (start.capacity() + stop.capacity()) + sizeof(Value) * value.capacity();
+    }
+
+    void push(const interval& i)
+    {
+        start.push_back(i.start);
+        stop.push_back(i.stop);
+        value.push_back(i.value);
+    }
+
+    bool erase(const interval& i)
+    {
+        for(size_t u = 0; u < value.size(); u++)
+        {
+            if(value[u] == i.value && start[u] == i.start && stop[u] == i.stop)
+            {
+                start[u] = start.back();
+                stop[u] = stop.back();
+                value[u] = value.back();
+                start.pop_back();
+                stop.pop_back();
+                value.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Same interface as IntervalTree
+    template <class UnaryFunction>
+    void visit_overlapping(Scalar lo, Scalar hi, UnaryFunction f) const
+    {
+        const size_t len = start.size();
+        const Scalar* ps = start.data();
+        const Scalar* pe = stop.data();
+
+        IRM_COUNT(scanned, len);
+
+        size_t first = 0;
+        for(; first + 16 <= len; first += 16)
+        {
+            // Hits are rare, most groups end on a zero mask right away
+            uint32_t mask = overlapMask(ps + first, pe + first, lo, hi);
+            for(size_t u = first; mask != 0; u++, mask >>= 1)
+                if(mask & 1U)
+                    f(interval(ps[u], pe[u], value[u]));
+        }
+
+        for(; first < len; first++)
+            if(pe[first] >= lo && ps[first] <= hi)
+                f(interval(ps[first], pe[first], value[first]));
+    }
+
+    std::vector<interval> findOverlapping(const Scalar& lo, const Scalar& hi) const
+    {
+        std::vector<interval> res;
+        visit_overlapping(lo, hi, [&](const interval& i) { res.push_back(i); });
+        return res;
+    }
+
+    template <class Line>
+    size_t findOverlappingIntersect(const Scalar& lo, const Scalar& hi, const Line& ll) const
+    {
+        size_t res = 0;
+        typename Line::vector_type g;
+        visit_overlapping(lo, hi, [&](const interval& i)
+        {
+            IRM_COUNT(candidates, 1);
+            res += ll.intersect(*i.value, g) ? 1 : 0;
+        });
+        IRM_COUNT(hits, res);
+        return res;
+    }
+
+private:
+
+    std::vector<Scalar> start, stop;
+    std::vector<Value> value;
+};
+
+// Start angle of a bucket and the sine and cosine that rotate into it
+template <class Scalar>
+struct BucketBound
+{
+    Scalar angle, sin, cos;
+};
+
+// Sine and cosine of angles in [0, PI] usable in constant expressions
+static constexpr double seriesSin(double x2, double term, unsigned int n)
+{
+    return n > 24 ? term : term + seriesSin(x2, -term * x2 / (double)((2 * n) * (2 * n + 1)), n + 1);
+}
+
+static constexpr double seriesCos(double x2, double term, unsigned int n)
+{
+    return n > 24 ? term : term + seriesCos(x2, -term * x2 / (double)((2 * n - 1) * (2 * n)), n + 1);
+}
+
+static constexpr double constSin(double x)
+{
+    return x > scalar_traits<double>::pi() / 2.0 ? constSin(scalar_traits<double>::pi() - x) : seriesSin(x * x, x, 1);
+}
+
+static constexpr double constCos(double x)
+{
+    return x > scalar_traits<double>::pi() / 2.0 ? -constCos(scalar_traits<double>::pi() - x) : seriesCos(x * x, 1.0, 1);
+}
+
+static constexpr double boundAngle(size_t i, unsigned int k)
+{
+    return k == 0 ? 0.0 : scalar_traits<double>::pi() * (double)(i) / (double)(k);
+}
+
+template <class Scalar>
+static constexpr BucketBound<Scalar> boundAt(size_t i, unsigned int k)
+{
+    return BucketBound<Scalar>{ (Scalar)(boundAngle(i, k)), (Scalar)(constSin(boundAngle(i, k))), (Scalar)(constCos(boundAngle(i, k))) };
+}
+
+template <size_t... I>
+struct index_list {};
+
+template <size_t N, size_t... I>
+struct make_index_list : make_index_list<N - 1, N - 1, I...> {};
+
+template <size_t... I>
+struct make_index_list<0, I...>
+{
+    typedef index_list<I...> type;
+};
+
+// The K + 1 bucket boundaries of a fixed bucket count, built at compile time
+template <class Scalar, unsigned int K, class L = typename make_index_list<K + 1>::type>
+struct FixedBounds;
+
+template <class Scalar, unsigned int K, size_t... I>
+struct FixedBounds<Scalar, K, index_list<I...>>
+{
+    static constexpr Scalar scale = (Scalar)((double)(K) / scalar_traits<double>::pi());
+    static constexpr BucketBound<Scalar> at[K + 1] = { boundAt<Scalar>(I, K)... };
+};
+
+template <class Scalar, unsigned int K, size_t... I>
+constexpr Scalar FixedBounds<Scalar, K, index_list<I...>>::scale;
+
+template <class Scalar, unsigned int K, size_t... I>
+constexpr BucketBound<Scalar> FixedBounds<Scalar, K, index_list<I...>>::at[K + 1];
+
+// The k + 1 bucket boundaries of a run time k
+template <class Scalar>
+static inline std::vector<BucketBound<Scalar>> bucketBounds(unsigned int k)
+{
+    std::vector<BucketBound<Scalar>> res;
+    for(unsigned int i = 0; i <= k; i++)
+    {
+        double a = boundAngle(i, k);
+        res.push_back(BucketBound<Scalar>{ (Scalar)(a), (Scalar)(std::sin(a)), (Scalar)(std::cos(a)) });
+    }
+    return res;
+}
+
+// Range of the x coordinate of p rotated by every angle in [bmin, bmax].
+// Its derivative is minus the rotated y, so where that changes sign
+// inside the bucket x peaks at +-|p| rather than at either end angle.
+template <class Scalar>
+static inline basic_vec2<Scalar> projectedRange(const BucketBound<Scalar>& bmin, const BucketBound<Scalar>& bmax, const basic_vec2<Scalar>& p)
+{
+    basic_vec2<Scalar> lo = rotate(p, bmin.sin, bmin.cos), hi = rotate(p, bmax.sin, bmax.cos);
+    basic_vec2<Scalar> res(std::min(lo.x, hi.x), std::max(lo.x, hi.x));
+
+    if(lo.y < 0 && hi.y >= 0)
+        res.y = std::sqrt(SQUARE(p.x) + SQUARE(p.y));
+    else if(lo.y > 0 && hi.y <= 0)
+        res.x = -std::sqrt(SQUARE(p.x) + SQUARE(p.y));
+
+    return res;
+}
+
+// Position of cell (x, y) of a 2^16 x 2^16 grid along the Hilbert curve
+// https://en.wikipedia.org/wiki/Hilbert_curve
+static inline uint64_t hilbertKey(uint32_t x, uint32_t y)
+{
+    uint64_t res = 0;
+    for(uint32_t s = 1U << 15; s > 0; s >>= 1)
+    {
+        uint32_t rx = (x & s) ? 1U : 0U, ry = (y & s) ? 1U : 0U;
+        res += (uint64_t)(s) * (uint64_t)(s) * (uint64_t)((3U * rx) ^ ry);
+
+        // Rotate the quadrant so the curve stays continuous
+        if(ry == 0)
+        {
+            if(rx == 1)
+            {
+                x = s - 1 - (x & (s - 1));
+                y = s - 1 - (y & (s - 1));
+            }
+            std::swap(x, y);
+        }
+    }
+    return res;
+}
+
+// z with P(|Z| <= z) = confidence for a standard normal Z, by bisection
+static inline double normalQuantile(double confidence)
+{
+    double lo = 0.0, hi = 40.0;
+    for(unsigned int i = 0; i < 100; i++)
+    {
+        double mid = (lo + hi) / 2.0;
+        if(std::erf(mid / std::sqrt(2.0)) < confidence)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return (lo + hi) / 2.0;
+}
+
+// SplitMix64 (Steele, Lea and Flood), a uniform double in (0, 1) per call
+struct SplitMix
+{
+    explicit SplitMix(uint64_t seed) : state(seed) {}
+
+    double next()
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        return ((double)(z >> 11) + 0.5) / 9007199254740992.0;
+    }
+
+    uint64_t state;
+};
+
+// Bucket trees live in a fixed array when K is known at compile time
+template <class T, unsigned int K>
+struct BucketArray
+{
+    typedef std::array<T, K> type;
+};
+
+template <class T>
+struct BucketArray<T, 0>
+{
+    typedef std::vector<T> type;
+};
+
+// Scalar is the coordinate type (float or double). Segments can carry a
+// Payload (e.g. the caller's ID), stored inline with their geometry, so
+// query results lead straight to it. IRM is the float, payload-free index.
+//
+// K fixes the bucket count at compile time: boundary angles and their
+// rotations come from a constant table, the trees sit in a fixed array and
+// picking a bucket is a multiply by a constant. K = 0 takes k at run time.
+template <class Scalar = float, class Payload = void, unsigned int K = 0>
+class BasicIRM
 {
 public:
 
-    IRM(unsigned int k, const std::vector<segment>& segs) : sz(0), k(k), segments(segs)
+    typedef Scalar scalar_type;
+    typedef Payload payload_type;
+    typedef basic_vec2<Scalar> vec2_type;
+    typedef basic_segment<Scalar, Payload> segment_type;
+    typedef basic_line<Scalar> line_type;
+
+    typedef Interval<Scalar, const segment_type*> interval;
+    typedef IntervalTree<Scalar, const segment_type*> tree;
+    typedef FlatBucket<Scalar, const segment_type*> flat_bucket;
+
+    // Storage order of the segments. INPUT keeps the caller's order, HILBERT
+    // sorts each stored batch along a Hilbert curve over the segment
+    // midpoints, so the candidates of one query, which lie near each other
+    // along the line, mostly share cache lines. Handles are unaffected.
+    enum Layout { INPUT, HILBERT };
+
+    // Inserted segments are staged until more than bufferSize of them are
+    // pending, and then merged into the bucket trees in one batch.
+    BasicIRM(unsigned int k, const std::vector<segment_type>& segs, size_t bufferSize = 1024, Layout layout = INPUT) :
+        k(k), mode(FAST), strategy(TREE), layout(layout), scale(0), bufferSize(bufferSize), stamp(nextStamp())
+    {
+        assert(k != 0 && (K == 0 || k == K));
+
+        if(K == 0)
+        {
+            bounds = std::make_shared<const std::vector<BucketBound<Scalar>>>(bucketBounds<Scalar>(k));
+            scale = (Scalar)((double)(k) / scalar_traits<double>::pi());
+        }
+
+        resetCounters();
+        setSampling(0.05);
+        current = std::make_shared<Version>();
+        append(*current, segs);
+        generate(*current);
+    }
+
+    // Only for a fixed bucket count
+    BasicIRM(const std::vector<segment_type>& segs, size_t bufferSize = 1024, Layout layout = INPUT) : BasicIRM(K, segs, bufferSize, layout)
+    {
+        static_assert(K != 0, "the bucket count must be given at run time");
+    }
+
+    // Copies share the segments and bucket trees of the original, so taking
+    // a snapshot is O(1). Modifying either copy afterwards only copies the
+    // tree paths and handle chunks it touches and leaves the other one
+    // intact.
+    BasicIRM(const BasicIRM&) = default;
+    BasicIRM& operator=(const BasicIRM&) = default;
+
+    inline size_t count()
+    {
+        return current->segments.size() + current->pending->size();
+    }
+
+    inline size_t pending()
+    {
+        return current->pending->size();
+    }
+
+    // Handle of a segment returned by query or nearest, i.e. the index it
+    // would be removed or updated by. The id stored next to the segment in
+    // its block grows with the handle, so the handle table is binary
+    // searched for it: O(log N), right after a modification too.
+    size_t handleOf(const segment_type* s)
+    {
+        const Version& v = *current;
+
+        if(blockOf(v, s) != v.blocks.size())
+        {
+            const size_t id = idOf(v, s);
+            const size_t h = v.segments.lower_bound(id, [&](const segment_type* p, size_t i) { return idOf(v, p) < i; });
+            if(h < v.segments.size() && v.segments[h] == s)
+                return h;
+        }
+
+        // Staged segments are found in the buffer
+        for(size_t u = 0; u < v.pending->size(); u++)
+            if(&v.pending->at(u) == s)
+                return v.segments.size() + u;
+
+        assert(false);
+        return count();
+    }
+
+    struct BucketStats
+    {
+        size_t intervals, nodes, depth;
+        size_t nodeBytes, intervalBytes, slackBytes, flatBytes;
+        double averageWidth;
+
+        // Whether queries scan the flat copy, and the estimated cost of a
+        // query either way (see Plan)
+        bool scan;
+        double treeCost, scanCost;
+
+        inline size_t bytes() const
+        {
+            return nodeBytes + intervalBytes + slackBytes + flatBytes;
+        }
+    };
+
+    struct Stats
+    {
+        std::vector<BucketStats> buckets;
+
+        // Live segments and segments still held by blocks (live + dead)
+        size_t segments, stored, pending;
+        size_t segmentBytes, bufferBytes;
+
+        size_t bytes() const
+        {
+            size_t res = segmentBytes + bufferBytes;
+            for(const BucketStats& b : buckets)
+                res += b.bytes();
+            return res;
+        }
+    };
+
+    // Memory and shape of every bucket. Trees and blocks shared with
+    // snapshots are counted in full.
+    Stats statistics() const
+    {
+        const Version& v = *current;
+
+        Stats res;
+        res.segments = v.segments.size();
+        res.stored = v.stored;
+        res.pending = v.pending->size();
+        res.bufferBytes = v.pending->bytes();
+        res.segmentBytes = v.segments.bytes();
+
+        for(const auto& b : v.blocks)
+            res.segmentBytes += sizeof(segment_type) * b->segments.capacity() + sizeof(size_t) * b->ids.capacity() + sizeof(*b) + tree::shared_overhead;
+
+        for(unsigned int i = 0; i < buckets(); i++)
+        {
+            const tree& t = *v.t[i];
+            typename tree::tree_stats ts = t.stats();
+            Cost c = estimate(t, buckets());
+
+            BucketStats bs;
+            bs.flatBytes = v.flat[i] ? v.flat[i]->bytes() + sizeof(flat_bucket) : 0;
+            bs.scan = (bool)(v.flat[i]);
+            bs.treeCost = c.tree;
+            bs.scanCost = c.scan;
+            bs.intervals = ts.intervals;
+            bs.nodes = ts.nodes;
+            bs.depth = ts.depth;
+            bs.nodeBytes = ts.node_bytes;
+            bs.intervalBytes = ts.interval_bytes;
+            bs.slackBytes = ts.slack_bytes;
+            bs.averageWidth = ts.intervals == 0 ? 0.0 : ts.total_width / (double)(ts.intervals);
+            res.buckets.push_back(bs);
+        }
+
+        return res;
+    }
+
+    // Bytes of interval payload stored in the buckets, without tree overhead
+    inline size_t rawSize()
+    {
+        size_t res = 0;
+        for(const auto& t : current->t)
+            res += t->stats().intervals;
+        return sizeof(interval) * res;
+    }
+
+    inline unsigned int buckets() const
+    {
+        return K == 0 ? k : K;
+    }
+
+    // Per bucket query counters, all zero unless built with IRM_INSTRUMENT
+    inline const std::vector<QueryCounters>& counters() const
+    {
+        return probes;
+    }
+
+    inline void resetCounters()
+    {
+        probes.assign(k, QueryCounters());
+    }
+
+    // Changes on every modification and predicate or plan change and is
+    // never reused by another IRM, so two IRMs with the same generation hold
+    // the same segments and answer queries alike
+    inline size_t generation() const
+    {
+        return stamp;
+    }
+
+    // How candidates are confirmed: FAST uses line::intersect as is,
+    // FILTERED the exact side-of-line predicate of Predicates.hpp
+    enum Predicate { FAST, FILTERED };
+
+    inline void setPredicate(Predicate p)
+    {
+        // Results change, so caches keyed by the generation must drop theirs
+        if(p != mode)
+            stamp = nextStamp();
+        mode = p;
+    }
+
+    inline Predicate predicate() const
+    {
+        return mode;
+    }
+
+    // How a bucket is searched: TREE walks its interval tree, SCAN tests
+    // every interval of a flat copy and AUTO picks per bucket whichever a
+    // cost model expects to be cheaper. The model probes the tree at a few
+    // interval midpoints to estimate the nodes and intervals a query looks
+    // at, against one cheaper test per interval for the scan. Plans are
+    // made whenever the trees are built or rebuilt, not on every update.
+    enum Plan { TREE, SCAN, AUTO };
+
+    void setPlan(Plan p)
+    {
+        strategy = p;
+        replan(writable());
+    }
+
+    inline Plan plan() const
+    {
+        return strategy;
+    }
+
+    unsigned int bucket(Scalar angle) const
+    {
+        unsigned int n = (unsigned int)(std::floor(angle * (K == 0 ? scale : FixedBounds<Scalar, K>::scale)));
+        return std::min(n, buckets() - 1);
+    }
+
+    size_t querySize(const line_type& l)
+    {
+        vec2_type p(lineToTransformAngle(l), transformLine(l));
+        unsigned int n = bucket(p.x);
+        IRM_PROBE(n);
+
+        const Version& v = *current;
+        const Scalar lo = p.y - traits::epsilon(), hi = p.y + traits::epsilon();
+
+        if(mode == FILTERED)
+        {
+            robust_line<Scalar> r(l);
+            size_t res = v.flat[n] ? scanned(*v.flat[n]).findOverlappingIntersect(lo, hi, r) : v.t[n]->findOverlappingIntersect(lo, hi, r);
+            v.pending->visitWith(r, [&](const segment_type&) { res++; });
+            return res;
+        }
+
+        return (v.flat[n] ? scanned(*v.flat[n]).findOverlappingIntersect(lo, hi, l) : v.t[n]->findOverlappingIntersect(lo, hi, l)) + v.pending->countIntersect(l);
+    }
+
+    // An approximate count and the interval holding the true count with the
+    // confidence given to setSampling
+    struct Estimate
+    {
+        double count, low, high;
+
+        // Candidates of the bucket and how many of them were confirmed
+        size_t candidates, sampled;
+    };
+
+    // Sample size of estimateSize: enough candidates that the estimate is
+    // within error * candidates of the true count with the given
+    // confidence, whatever share of them intersects (0.05 and 0.95 by
+    // default, i.e. 385 samples)
+    void setSampling(double error, double confidence = 0.95)
+    {
+        assert(error > 0.0 && 0.0 < confidence && confidence < 1.0);
+
+        zScore = normalQuantile(confidence);
+        samples = (size_t)(std::max(1.0, std::ceil(SQUARE(zScore / (2.0 * error)))));
+    }
+
+    inline size_t sampleSize() const
+    {
+        return samples;
+    }
+
+    // Like querySize, but only confirms a uniform sample of the bucket's
+    // candidates with line::intersect and scales the share that hit up to
+    // all of them. The candidates are still counted exactly (two compares
+    // each) while one pass of reservoir sampling (Li's Algorithm L) keeps
+    // the sample, seeded by the line so results are repeatable. Buckets
+    // with no more candidates than the sample size and the pending segments
+    // are counted exactly. The interval is Wilson's score interval with the
+    // finite population correction.
+    Estimate estimateSize(const line_type& l)
+    {
+        vec2_type p(lineToTransformAngle(l), transformLine(l));
+        unsigned int n = bucket(p.x);
+        IRM_PROBE(n);
+
+        const Version& v = *current;
+        const Scalar lo = p.y - traits::epsilon(), hi = p.y + traits::epsilon();
+
+        uint64_t seed[2] = { 0, 0 };
+        std::memcpy(&seed[0], &l.slope, sizeof(l.slope));
+        std::memcpy(&seed[1], &l.offset, sizeof(l.offset));
+        SplitMix rng(seed[0] * 0x9E3779B97F4A7C15ULL ^ seed[1]);
+
+        std::vector<const segment_type*> reservoir;
+        reservoir.reserve(samples);
+
+        size_t seen = 0, skip = 0;
+        double w = 1.0;
+
+        // Candidates to pass over before the next one enters the reservoir
+        auto advance = [&]()
+        {
+            w *= std::exp(std::log(rng.next()) / (double)(samples));
+            skip = (size_t)(std::min(std::floor(std::log(rng.next()) / std::log(1.0 - w)), 1e18));
+        };
+
+        auto sample = [&](const interval& i)
+        {
+            if(seen++ < samples)
+            {
+                reservoir.push_back(i.value);
+                if(seen == samples)
+                    advance();
+                return;
+            }
+
+            if(skip != 0)
+            {
+                skip--;
+                return;
+            }
+
+            reservoir[std::min((size_t)(rng.next() * (double)(samples)), samples - 1)] = i.value;
+            advance();
+        };
+
+        if(v.flat[n])
+            scanned(*v.flat[n]).visit_overlapping(lo, hi, sample);
+        else
+            v.t[n]->visit_overlapping(lo, hi, sample);
+
+        IRM_COUNT(candidates, reservoir.size());
+
+        const robust_line<Scalar> r(l);
+        size_t hits = 0;
+        vec2_type tmp;
+        for(const segment_type* s : reservoir)
+            hits += (mode == FILTERED ? r.intersect(*s, tmp) : l.intersect(*s, tmp)) ? 1 : 0;
+
+        IRM_COUNT(hits, hits);
+
+        Estimate res;
+        res.candidates = seen;
+        res.sampled = reservoir.size();
+
+        if(seen <= samples)
+        {
+            res.count = res.low = res.high = (double)(hits);
+        }
+        else
+        {
+            const double c = (double)(seen), m = (double)(res.sampled), share = (double)(hits) / m;
+            const double effective = m * (c - 1.0) / (c - m);
+            const double z2 = SQUARE(zScore) / effective;
+
+            const double center = (share + z2 / 2.0) / (1.0 + z2);
+            const double half = zScore * std::sqrt(share * (1.0 - share) / effective + z2 / (4.0 * effective)) / (1.0 + z2);
+
+            res.count = c * share;
+            res.low = c * std::max(0.0, center - half);
+            res.high = c * std::min(1.0, center + half);
+        }
+
+        size_t exact = 0;
+        if(mode == FILTERED)
+            v.pending->visitWith(r, [&](const segment_type&) { exact++; });
+        else
+            exact = v.pending->countIntersect(l);
+
+        res.count += (double)(exact);
+        res.low += (double)(exact);
+        res.high += (double)(exact);
+        return res;
+    }
+
+    std::vector<interval> query(const line_type& l)
     {
-        assert(k != 0);
-        generate();
+        vec2_type p(lineToTransformAngle(l), transformLine(l));
+        unsigned int n = bucket(p.x);
+        IRM_PROBE(n);
+
+        const Version& v = *current;
+        const Scalar lo = p.y - traits::epsilon(), hi = p.y + traits::epsilon();
+
+        std::vector<interval> s = v.flat[n] ? scanned(*v.flat[n]).findOverlapping(lo, hi) : v.t[n]->findOverlapping(lo, hi);
+        IRM_COUNT(candidates, s.size());
+
+        const robust_line<Scalar> r(l);
+        vec2_type o;
+        typename std::vector<interval>::iterator i;
+
+        for (i = s.begin(); i != s.end();)
+        {
+            if (!(mode == FILTERED ? r.intersect(*((*i).value), o) : l.intersect(*((*i).value), o)))
+                i = s.erase(i);
+            else
+                ++i;
+        }
+
+        IRM_COUNT(hits, s.size());
+
+        auto add = [&](const segment_type& g)
+        {
+            s.push_back(bucketInterval(n, &g));
+        };
+
+        if(mode == FILTERED)
+            current->pending->visitWith(r, add);
+        else
+            current->pending->visitIntersect(l, add);
+
+        return s;
     }
 
-    inline size_t count()
+    // Payloads of the segments l intersects, in the order query returns them
+    template <class P = Payload>
+    typename std::enable_if<!std::is_void<P>::value, std::vector<P>>::type queryPayloads(const line_type& l)
     {
-        return segments.size();
+        std::vector<interval> hits = query(l);
+
+        std::vector<P> res;
+        res.reserve(hits.size());
+        for(const interval& i : hits)
+            res.push_back(i.value->payload);
+        return res;
     }
 
-    inline size_t rawSize()
+    // An intersection and its distance along the line from a reference point
+    struct Crossing
+    {
+        Scalar distance;
+        vec2_type point;
+        const segment_type* segment;
+
+        bool operator<(const Crossing& o) const
+        {
+            return distance < o.distance;
+        }
+    };
+
+    // The m intersections of l nearest to origin (projected onto l), by
+    // increasing distance. direction 1 only keeps those ahead of origin
+    // towards increasing x, -1 those behind it and 0 both. Hits are kept in
+    // a heap of at most m entries while the bucket is scanned.
+    std::vector<Crossing> nearest(const line_type& l, const vec2_type& origin, size_t m, int direction = 0)
     {
-        return sz;
+        std::vector<Crossing> heap;
+        if(m == 0)
+            return heap;
+
+        heap.reserve(m);
+
+        vec2_type p(lineToTransformAngle(l), transformLine(l));
+        unsigned int n = bucket(p.x);
+        IRM_PROBE(n);
+
+        const Scalar norm = std::sqrt(1 + SQUARE(l.slope));
+        const robust_line<Scalar> r(l);
+
+        auto offer = [&](const segment_type& s)
+        {
+            Crossing c;
+            if(!(mode == FILTERED ? r.intersect(s, c.point) : l.intersect(s, c.point)))
+                return;
+
+            Scalar along = ((c.point.x - origin.x) + l.slope * (c.point.y - origin.y)) / norm;
+            if((direction > 0 && along < 0) || (direction < 0 && along > 0))
+                return;
+
+            IRM_COUNT(hits, 1);
+            c.distance = std::fabs(along);
+            c.segment = &s;
+
+            if(heap.size() < m)
+            {
+                heap.push_back(c);
+                std::push_heap(heap.begin(), heap.end());
+            }
+            else if(c.distance < heap.front().distance)
+            {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.back() = c;
+                std::push_heap(heap.begin(), heap.end());
+            }
+        };
+
+        auto candidate = [&](const interval& i)
+        {
+            IRM_COUNT(candidates, 1);
+            offer(*i.value);
+        };
+
+        const Scalar lo = p.y - traits::epsilon(), hi = p.y + traits::epsilon();
+        if(current->flat[n])
+            scanned(*current->flat[n]).visit_overlapping(lo, hi, candidate);
+        else
+            current->t[n]->visit_overlapping(lo, hi, candidate);
+
+        const SegmentBuffer<Scalar, Payload>& pending = *current->pending;
+        IRM_COUNT(candidates, pending.size());
+        for(size_t i = 0; i < pending.size(); i++)
+            offer(pending.at(i));
+
+        std::sort_heap(heap.begin(), heap.end());
+        return heap;
     }
 
-    size_t querySize(const line& l)
+    // Visits every segment that may touch the line of points p with
+    // rotate(p, angle).x == distance, for an angle in [0, PI]: the overlapping
+    // intervals of its bucket and all pending segments, unconfirmed. Unlike
+    // line_type this form also describes vertical lines.
+    template <class UnaryFunction>
+    void visitCandidates(Scalar angle, Scalar distance, UnaryFunction f)
     {
-        vec2 p(lineToTransformAngle(l), transformLine(l));
-        unsigned int n = (unsigned int)(std::floor((p.x * (float)(k)) / PI));
+        unsigned int n = bucket(angle);
+        IRM_PROBE(n);
+
+        const Version& v = *current;
+        const Scalar lo = distance - traits::epsilon(), hi = distance + traits::epsilon();
+
+        auto candidate = [&](const interval& i)
+        {
+            IRM_COUNT(candidates, 1);
+            f(*i.value);
+        };
+
+        if(v.flat[n])
+            scanned(*v.flat[n]).visit_overlapping(lo, hi, candidate);
+        else
+            v.t[n]->visit_overlapping(lo, hi, candidate);
 
-        return t[n].findOverlappingIntersect(p.y - EPSILON, p.y + EPSILON, l);
+        IRM_COUNT(candidates, v.pending->size());
+        for(size_t i = 0; i < v.pending->size(); i++)
+            f(v.pending->at(i));
     }
 
-    std::vector<Interval<float, segment*>> query(const line& l)
+    size_t insert(const std::vector<segment_type>& segs)
     {
-        vec2 p(lineToTransformAngle(l), transformLine(l));
-        unsigned int n = (unsigned int)(std::floor((p.x * (float)(k)) / PI));
+        Version& v = writable();
+        size_t startlen = v.segments.size() + v.pending->size();
 
-        std::vector<Interval<float, segment*>> s = t[n].findOverlapping(p.y - EPSILON, p.y + EPSILON);
+        for(const segment_type& s : segs)
+            staged(v).push(s);
 
-        vec2 o;
-        std::vector<Interval<float, segment*>>::iterator i;
+        if(v.pending->size() > bufferSize)
+            merge(v);
 
-        for (i = s.begin(); i != s.end();)
+        return startlen;
+    }
+
+    void remove(size_t from)
+    {
+        Version& v = writable();
+
+        if(from >= v.segments.size())
         {
-            if (!l.intersect(*((*i).value), o))
-                i = s.erase(i);
-            else
-                ++i;
+            staged(v).erase(from - v.segments.size());
+            return;
         }
 
-        return s;
+        const segment_type* s = v.segments[from];
+        v.segments.erase(from);
+
+        // Reclaim the blocks once most of their segments are dead
+        if(v.segments.size() * 2 < v.stored)
+        {
+            compact(v);
+            generate(v);
+        }
+        else
+        {
+            for(unsigned int i = 0; i < buckets(); i++)
+                relocate(v, i, s, nullptr);
+        }
     }
-    
-    size_t insert(const std::vector<segment>& segs)
+
+    // Moves the segment at handle (the index returned by insert, or its index
+    // in the constructor's list) to s. Only its k bucket intervals are
+    // relocated; the rest of the trees is left untouched. The batched form
+    // takes distinct handles. A segment still shared with a snapshot is
+    // copied to another block, and once there are more than about
+    // N / BLOCK_RATIO blocks the update repacks and rebuilds the index.
+    void update(size_t handle, const segment_type& s)
     {
-        size_t startlen = segments.size();
-        segments.insert(segments.end(), segs.begin(), segs.end());
-        t.clear();
-        generate();
-        return startlen;
+        update(std::vector<size_t>(1, handle), std::vector<segment_type>(1, s));
     }
-    
-    void remove(size_t from)
+
+    void update(const std::vector<size_t>& handles, const std::vector<segment_type>& segs)
+    {
+        assert(handles.size() == segs.size());
+
+        Version& v = writable();
+
+        // Blocks shared with a snapshot can't be written to, so the new
+        // geometry of segments living in them goes to the open block while
+        // it is private and has room, or else to a fresh one
+        std::vector<std::pair<size_t, bool>> moved;
+        size_t copies = 0;
+
+        for(size_t u = 0; u < handles.size(); u++)
+        {
+            if(handles[u] >= v.segments.size())
+            {
+                staged(v).set(handles[u] - v.segments.size(), segs[u]);
+                continue;
+            }
+
+            bool inplace = v.blocks[blockOf(v, v.segments[handles[u]])].use_count() == 1;
+
+            moved.push_back(std::make_pair(u, inplace));
+            copies += inplace ? 0 : 1;
+        }
+
+        if(moved.empty())
+            return;
+
+        Block* block = copies != 0 && appendable(v, copies) ? v.open : nullptr;
+
+        // Every fresh block makes copying the version, addBlock and blockOf
+        // dearer, so past a limit the segments are packed again
+        const bool fragmented = copies != 0 && !block && v.blocks.size() >= MIN_BLOCKS + v.segments.size() / BLOCK_RATIO;
+
+        if(fragmented || v.segments.size() * 2 < v.stored + copies || moved.size() * REBUILD_RATIO > v.segments.size())
+        {
+            for(auto& m : moved)
+                write(v, handles[m.first], segs[m.first], m.second);
+
+            compact(v);
+            generate(v);
+            return;
+        }
+
+        for(unsigned int i = 0; i < buckets(); i++)
+            for(auto& m : moved)
+                relocate(v, i, v.segments[handles[m.first]], nullptr);
+
+        // Room is reserved up front, as pointers into the block must stay valid
+        std::shared_ptr<Block> fresh;
+        if(copies != 0 && !block)
+        {
+            const size_t room = copies < SPARE ? (size_t)(SPARE) : copies;
+            fresh = std::make_shared<Block>();
+            fresh->segments.reserve(room);
+            fresh->ids.reserve(room);
+            block = v.open = fresh.get();
+        }
+        v.stored += copies;
+
+        for(auto& m : moved)
+        {
+            if(m.second)
+                write(v, handles[m.first], segs[m.first], true);
+            else
+            {
+                block->ids.push_back(idOf(v, v.segments[handles[m.first]]));
+                block->segments.push_back(segs[m.first]);
+                v.segments.set(handles[m.first], &block->segments.back());
+            }
+        }
+
+        if(fresh)
+            addBlock(v, fresh);
+
+        for(unsigned int i = 0; i < buckets(); i++)
+            for(auto& m : moved)
+                relocate(v, i, nullptr, v.segments[handles[m.first]]);
+    }
+
+    // Merges all staged segments into the bucket trees now
+    void flush()
     {
-        segments.erase(segments.begin() + from);
-        t.clear();
-        generate();
+        if(!current->pending->empty())
+            merge(writable());
     }
 
-    static float lineToTransformAngle(const line& l)
+    static Scalar lineToTransformAngle(const line_type& l)
     {
-        float a = l.toAngle();
-        if(0.0F <= a && a <= PI)
-            return PI - a;
+        Scalar a = l.toAngle();
+        if(0 <= a && a <= traits::pi())
+            return traits::pi() - a;
         else
             return std::fabs(a);
     }
 
-    static float transformLine(const line& l)
+    static Scalar transformLine(const line_type& l)
     {
         return rotate(l.closest(), lineToTransformAngle(l)).x;
     }
 
 private:
 
-    void generate()
+    typedef scalar_traits<Scalar> traits;
+
+    // Batches over 1 / REBUILD_RATIO of the index size trigger a full rebuild
+    static const size_t REBUILD_RATIO = 4;
+
+    // Updates of segments shared with a snapshot go to blocks with room for
+    // SPARE segments, and repack the index once it holds more than
+    // MIN_BLOCKS plus one block per BLOCK_RATIO segments
+    static const size_t SPARE = 64;
+    static const size_t MIN_BLOCKS = 16, BLOCK_RATIO = 8;
+
+    // Relative costs of entering a tree node, of looking at an interval in
+    // a node and of testing an interval in a flat scan, fitted to the plan
+    // suite on x86-64. Queries jump between buckets, so once the bounds of
+    // all buckets take more than SCAN_CACHE bytes a scan streams from memory
+    // and costs STREAM_COST per interval instead. PLAN_PROBES tree queries
+    // estimate a bucket's cost.
+    static constexpr double NODE_COST = 10.0, TREE_COST = 1.0, SCAN_COST = 0.15, STREAM_COST = 0.5;
+    static const size_t SCAN_CACHE = 8 << 20;
+    static const size_t PLAN_PROBES = 16;
+
+    // Segments stored together, each with an id. Ids grow with the handle
+    // and a segment keeps its id when updated, so the handle of an id is
+    // found by binary search.
+    struct Block
     {
-        const float c = PI / ((float)(k));
-        const size_t len = segments.size();
+        std::vector<segment_type> segments;
+        std::vector<size_t> ids;
+    };
+
+    // State shared between snapshots. Segments live in blocks that never
+    // reallocate, so the interval pointers into them stay valid for as
+    // long as any snapshot references the block. A block is only written to
+    // while a single version owns it. The handle table and the staging
+    // buffer are shared the same way, so the copy a write makes of a shared
+    // version costs O(N / CHUNK) plus one pointer per block and bucket.
+    struct Version
+    {
+        Version() : stored(0), nextId(0), open(nullptr), pending(std::make_shared<SegmentBuffer<Scalar, Payload>>()) {}
+
+        size_t stored, nextId;
+
+        // Block of the latest updates, appended to while private, if any
+        Block* open;
+
+        // By address, so blockOf can binary search them
+        std::vector<std::shared_ptr<Block>> blocks;
+        HandleTable<const segment_type*> segments;
+        typename BucketArray<typename tree::const_ptr, K>::type t;
+        std::shared_ptr<SegmentBuffer<Scalar, Payload>> pending;
+
+        // Flat copies of the buckets planned to be scanned, null for the
+        // others. Like blocks, only written to while not shared.
+        typename BucketArray<std::shared_ptr<flat_bucket>, K>::type flat;
+    };
+
+    // Copy on write: the version is only duplicated while a snapshot shares it
+    Version& writable()
+    {
+        stamp = nextStamp();
+
+        if(current.use_count() != 1)
+            current = std::make_shared<Version>(*current);
+
+        return *current;
+    }
+
+    // The staging buffer of v, copied first while a snapshot shares it
+    static SegmentBuffer<Scalar, Payload>& staged(Version& v)
+    {
+        if(v.pending.use_count() != 1)
+            v.pending = std::make_shared<SegmentBuffer<Scalar, Payload>>(*v.pending);
+
+        return *v.pending;
+    }
+
+    void merge(Version& v)
+    {
+        const size_t startlen = v.segments.size();
+
+        std::vector<segment_type> segs;
+        segs.reserve(v.pending->size());
+        for(size_t i = 0; i < v.pending->size(); i++)
+            segs.push_back(v.pending->at(i));
+
+        v.pending = std::make_shared<SegmentBuffer<Scalar, Payload>>();
+        append(v, segs);
+
+        // Large batches are cheaper to bulk load than to insert one by one
+        if(segs.size() * REBUILD_RATIO > startlen)
+        {
+            compact(v);
+            generate(v);
+        }
+        else
+        {
+            for(unsigned int i = 0; i < buckets(); i++)
+                for(size_t u = startlen; u < v.segments.size(); u++)
+                    relocate(v, i, nullptr, v.segments[u]);
+
+        }
+    }
+
+    void generate(Version& v)
+    {
+        const size_t len = v.segments.size();
+
+        resize(v.t, buckets());
+
+        for(unsigned int i = 0; i < buckets(); i++)
+        {
+            const BucketBound<Scalar>& bmin = bound(i);
+            const BucketBound<Scalar>& bmax = bound(i + 1);
+            std::vector<interval> tmp;
+            tmp.reserve(len);
+
+            v.segments.visit([&](const segment_type* s) { tmp.push_back(bucketInterval(bmin, bmax, s)); });
+
+            v.t[i] = std::make_shared<const tree>(std::move(tmp));
+        }
+
+        replan(v);
+    }
+
+    struct Cost
+    {
+        double tree, scan;
+    };
+
+    // Expected cost of a query in a bucket with tree t, one of n buckets of
+    // about the same size, probing it at the midpoints of evenly spaced
+    // intervals
+    static Cost estimate(const tree& t, unsigned int n)
+    {
+        size_t len = 0;
+        t.visit_all([&](const interval&) { len++; });
+
+        Cost res = { 0.0, (2 * sizeof(Scalar) * len * n > SCAN_CACHE ? STREAM_COST : SCAN_COST) * (double)(len) };
+        if(len == 0)
+            return res;
 
-        for(size_t i = 0; i < k; i++)
+        const size_t stride = std::max(len / PLAN_PROBES, (size_t)(1));
+        size_t u = 0, probes = 0, nodes = 0, scanned = 0;
+
+        t.visit_all([&](const interval& i)
         {
-            float bmin = ((float)(i)) * c, bmax = ((float)(i + 1)) * c;
-            std::vector<Interval<float, segment*>> tmp;
+            if(u++ % stride != 0)
+                return;
+
+            const Scalar x = (i.start + i.stop) / 2;
+            t.cost_near(x - traits::epsilon(), x + traits::epsilon(), nodes, scanned);
+            probes++;
+        });
 
-            for(size_t u = 0; u < len; u++)
+        res.tree = (NODE_COST * (double)(nodes) + TREE_COST * (double)(scanned)) / (double)(probes);
+        return res;
+    }
+
+    void replan(Version& v) const
+    {
+        resize(v.flat, buckets());
+
+        for(unsigned int i = 0; i < buckets(); i++)
+        {
+            bool scan = strategy == SCAN;
+            if(strategy == AUTO)
             {
-                vec2 xmin = xBound(bmin, segments[u]), xmax = xBound(bmax, segments[u]);
-                vec2 bounds = vec2(std::min(xmin.x, xmax.x), std::max(xmin.y, xmax.y));
+                Cost c = estimate(*v.t[i], buckets());
+                scan = c.scan < c.tree;
+            }
+
+            v.flat[i] = scan ? std::make_shared<flat_bucket>(*v.t[i]) : nullptr;
+        }
+    }
+
+    static inline const flat_bucket& scanned(const flat_bucket& f)
+    {
+        IRM_COUNT(scans, 1);
+        return f;
+    }
+
+    // Stores segs in a new block, in the layout's order, and gives them the
+    // next handles in their given order
+    void append(Version& v, const std::vector<segment_type>& segs) const
+    {
+        if(segs.empty())
+            return;
+
+        std::shared_ptr<Block> block = std::make_shared<Block>();
+        block->segments.reserve(segs.size());
+        block->ids.reserve(segs.size());
+
+        if(layout == INPUT)
+        {
+            block->segments = segs;
+            for(size_t u = 0; u < segs.size(); u++)
+                block->ids.push_back(v.nextId + u);
 
-                tmp.push_back(Interval<float, segment*>(bounds.x, bounds.y, &segments[u]));
+            for(const segment_type& s : block->segments)
+                v.segments.push_back(&s);
+        }
+        else
+        {
+            std::vector<const segment_type*> stored(segs.size());
+            for(const auto& key : hilbertOrder(segs))
+            {
+                block->segments.push_back(segs[key.second]);
+                block->ids.push_back(v.nextId + key.second);
+                stored[key.second] = &block->segments.back();
             }
 
-            t.push_back(IntervalTree<float, segment*>(std::move(tmp)));
+            for(const segment_type* s : stored)
+                v.segments.push_back(s);
+        }
+
+        v.nextId += segs.size();
+        v.stored += segs.size();
+        addBlock(v, block);
+    }
+
+    // Inserts block into v.blocks by address
+    static void addBlock(Version& v, const std::shared_ptr<Block>& block)
+    {
+        auto i = std::upper_bound(v.blocks.begin(), v.blocks.end(), block->segments.data(), [](const segment_type* p, const std::shared_ptr<Block>& b)
+        {
+            return std::less<const segment_type*>()(p, b->segments.data());
+        });
+        v.blocks.insert(i, block);
+    }
+
+    // Index of the block holding s in v.blocks, or v.blocks.size() for a
+    // staged segment
+    static size_t blockOf(const Version& v, const segment_type* s)
+    {
+        auto i = std::upper_bound(v.blocks.begin(), v.blocks.end(), s, [](const segment_type* p, const std::shared_ptr<Block>& b)
+        {
+            return std::less<const segment_type*>()(p, b->segments.data());
+        });
+
+        if(i == v.blocks.begin())
+            return v.blocks.size();
+
+        const Block& b = **(i - 1);
+        return std::less<const segment_type*>()(s, b.segments.data() + b.segments.size()) ? (size_t)(i - 1 - v.blocks.begin()) : v.blocks.size();
+    }
+
+    // Whether n more segments fit in v.open without moving its segments
+    static bool appendable(const Version& v, size_t n)
+    {
+        return v.open && v.blocks[blockOf(v, v.open->segments.data())].use_count() == 1 &&
+               v.open->segments.size() + n <= v.open->segments.capacity();
+    }
+
+    // Id of the stored segment s
+    static size_t idOf(const Version& v, const segment_type* s)
+    {
+        const Block& b = *v.blocks[blockOf(v, s)];
+        return b.ids[(size_t)(s - b.segments.data())];
+    }
+
+    // (curve position, index) of every segment of segs, by curve position
+    static std::vector<std::pair<uint64_t, size_t>> hilbertOrder(const std::vector<segment_type>& segs)
+    {
+        Scalar xmin = traits::inf(), ymin = traits::inf(), xmax = -traits::inf(), ymax = -traits::inf();
+        for(const segment_type& s : segs)
+        {
+            xmin = std::min(xmin, std::min(s.a.x, s.b.x));
+            ymin = std::min(ymin, std::min(s.a.y, s.b.y));
+            xmax = std::max(xmax, std::max(s.a.x, s.b.x));
+            ymax = std::max(ymax, std::max(s.a.y, s.b.y));
+        }
+
+        const double cells = 65535.0;
+        const double sx = xmax > xmin ? cells / ((double)(xmax) - (double)(xmin)) : 0.0;
+        const double sy = ymax > ymin ? cells / ((double)(ymax) - (double)(ymin)) : 0.0;
+
+        std::vector<std::pair<uint64_t, size_t>> res;
+        res.reserve(segs.size());
+        for(size_t u = 0; u < segs.size(); u++)
+        {
+            double x = ((double)(segs[u].a.x) + (double)(segs[u].b.x)) / 2.0 - (double)(xmin);
+            double y = ((double)(segs[u].a.y) + (double)(segs[u].b.y)) / 2.0 - (double)(ymin);
+            res.push_back(std::make_pair(hilbertKey((uint32_t)(std::min(x * sx, cells)), (uint32_t)(std::min(y * sy, cells))), u));
+        }
+
+        std::sort(res.begin(), res.end());
+        return res;
+    }
+
+    static size_t nextStamp()
+    {
+        static std::atomic<size_t> counter(0);
+        return ++counter;
+    }
+
+    static void write(Version& v, size_t handle, const segment_type& s, bool inplace)
+    {
+        if(inplace)
+            *const_cast<segment_type*>(v.segments[handle]) = s;
+        else
+        {
+            std::shared_ptr<Block> block = std::make_shared<Block>();
+            block->segments.push_back(s);
+            block->ids.push_back(idOf(v, v.segments[handle]));
+            v.stored++;
+            v.segments.set(handle, &block->segments.back());
+            addBlock(v, block);
+        }
+    }
+
+    // Packs the live segments into a single block; the trees must be rebuilt
+    void compact(Version& v) const
+    {
+        std::vector<segment_type> live;
+        live.reserve(v.segments.size());
+
+        v.segments.visit([&](const segment_type* s) { live.push_back(*s); });
+
+        v.blocks.clear();
+        v.segments.clear();
+        v.stored = v.nextId = 0;
+        v.open = nullptr;
+        append(v, live);
+    }
+
+    interval bucketInterval(unsigned int i, const segment_type* s) const
+    {
+        return bucketInterval(bound(i), bound(i + 1), s);
+    }
+
+    inline const BucketBound<Scalar>& bound(unsigned int i) const
+    {
+        return K == 0 ? (*bounds)[i] : FixedBounds<Scalar, K>::at[i];
+    }
+
+    template <class T>
+    static void resize(std::vector<T>& t, unsigned int n)
+    {
+        t.assign(n, T());
+    }
+
+    template <class T, size_t N>
+    static void resize(std::array<T, N>& t, unsigned int)
+    {
+        t.fill(T());
+    }
+
+    // Removes the intervals of from and adds those of to in bucket i
+    void relocate(Version& v, unsigned int i, const segment_type* from, const segment_type* to) const
+    {
+        if(v.flat[i] && v.flat[i].use_count() != 1)
+            v.flat[i] = std::make_shared<flat_bucket>(*v.flat[i]);
+
+        if(from)
+        {
+            bool found;
+            v.t[i] = tree::remove(v.t[i], bucketInterval(i, from), found);
+            assert(found);
+
+            if(v.flat[i])
+            {
+                found = v.flat[i]->erase(bucketInterval(i, from));
+                assert(found);
+            }
         }
 
-        sz += sizeof(Interval<float, segment*>) * k * segments.size();
+        if(to)
+        {
+            v.t[i] = tree::insert(v.t[i], bucketInterval(i, to));
+
+            if(v.flat[i])
+                v.flat[i]->push(bucketInterval(i, to));
+        }
     }
 
-    static vec2 xBound(float theta, const segment& s)
+    static interval bucketInterval(const BucketBound<Scalar>& bmin, const BucketBound<Scalar>& bmax, const segment_type* s)
     {
-        segment e = segment(rotate(s.a, theta), rotate(s.b, theta));
-        return vec2(std::min(e.a.x, e.b.x), std::max(e.a.x, e.b.x));
+        vec2_type a = projectedRange(bmin, bmax, s->a), b = projectedRange(bmin, bmax, s->b);
+        return interval(std::min(a.x, b.x), std::max(a.y, b.y), s);
     }
 
-    size_t sz;
-    const unsigned int k;
-    std::vector<segment> segments;
-    std::vector<IntervalTree<float, segment*>> t;
+    unsigned int k;
+    Predicate mode;
+    Plan strategy;
+    Layout layout;
+
+    // Normal quantile of the sampling confidence and the sample size
+    double zScore;
+    size_t samples;
+
+    // Boundary table and bucket scale of a run time k
+    std::shared_ptr<const std::vector<BucketBound<Scalar>>> bounds;
+    Scalar scale;
+
+    size_t bufferSize;
+    size_t stamp;
+    std::shared_ptr<Version> current;
+    std::vector<QueryCounters> probes;
 };
+
+template <class Scalar, class Payload, unsigned int K>
+constexpr double BasicIRM<Scalar, Payload, K>::NODE_COST;
+
+template <class Scalar, class Payload, unsigned int K>
+constexpr double BasicIRM<Scalar, Payload, K>::TREE_COST;
+
+template <class Scalar, class Payload, unsigned int K>
+constexpr double BasicIRM<Scalar, Payload, K>::SCAN_COST;
+
+template <class Scalar, class Payload, unsigned int K>
+constexpr double BasicIRM<Scalar, Payload, K>::STREAM_COST;
+
+typedef BasicIRM<float> IRM;
+
+template <unsigned int K>
+using FixedIRM = BasicIRM<float, void, K>;
+
+#endif // IRM_HPP
@@ -31,6 +31,7 @@ SOFTWARE.
 
 // MODIFIED
 #include <Geometry.hpp>
+#include <Counters.hpp>
 
 #ifdef USE_INTERVAL_TREE_NAMESPACE
 namespace interval_tree {
@@ -91,27 +92,22 @@ public:
 
     ~IntervalTree() = default;
 
+    // MODIFIED
+
+    typedef std::shared_ptr<const IntervalTree> const_ptr;
+
+    // Nodes are immutable once built and children are shared between copies,
+    // so copying a tree is O(1) and never clones the subtrees.
     std::unique_ptr<IntervalTree> clone() const {
         return std::unique_ptr<IntervalTree>(new IntervalTree(*this));
     }
 
-    IntervalTree(const IntervalTree& other)
-    :   intervals(other.intervals),
-        left(other.left ? other.left->clone() : nullptr),
-        right(other.right ? other.right->clone() : nullptr),
-        center(other.center)
-    {}
-
+    IntervalTree(const IntervalTree&) = default;
+    IntervalTree& operator=(const IntervalTree&) = default;
     IntervalTree& operator=(IntervalTree&&) = default;
     IntervalTree(IntervalTree&&) = default;
 
-    IntervalTree& operator=(const IntervalTree& other) {
-        center = other.center;
-        intervals = other.intervals;
-        left = other.left ? other.left->clone() : nullptr;
-        right = other.right ? other.right->clone() : nullptr;
-        return *this;
-    }
+    // END MODIFIED
 
     IntervalTree(
             interval_vector&& ivals,
@@ -139,7 +135,9 @@ public:
         }
         if (depth == 0 || (ivals.size() < minbucket && ivals.size() < maxbucket)) {
             std::sort(ivals.begin(), ivals.end(), IntervalStartCmp());
-            intervals = std::move(ivals);
+            if (!ivals.empty()) {
+                intervals = std::make_shared<const interval_vector>(std::move(ivals));
+            }
             assert(is_valid().first);
             return;
         } else {
@@ -157,6 +155,7 @@ public:
 
             interval_vector lefts;
             interval_vector rights;
+            interval_vector centers;
 
             for (typename interval_vector::const_iterator i = ivals.begin();
                  i != ivals.end(); ++i) {
@@ -168,10 +167,14 @@ public:
                 } else {
                     assert(interval.start <= center);
                     assert(center <= interval.stop);
-                    intervals.push_back(interval);
+                    centers.push_back(interval);
                 }
             }
 
+            if (!centers.empty()) {
+                intervals = std::make_shared<const interval_vector>(std::move(centers));
+            }
+
             if (!lefts.empty()) {
                 left.reset(new IntervalTree(std::move(lefts),
                                             depth, minbucket, maxbucket,
@@ -189,8 +192,10 @@ public:
     // Call f on all intervals near the range [start, stop]:
     template <class UnaryFunction>
     void visit_near(const Scalar& start, const Scalar& stop, UnaryFunction f) const {
-        if (!intervals.empty() && ! (stop < intervals.front().start)) {
-            for (auto & i : intervals) {
+        IRM_COUNT(nodes, 1); // MODIFIED
+        if (intervals && ! (stop < intervals->front().start)) {
+            IRM_COUNT(scanned, intervals->size()); // MODIFIED
+            for (auto & i : *intervals) {
               f(i);
             }
         }
@@ -242,16 +247,119 @@ public:
 
     // MODIFIED
 
-    size_t findOverlappingIntersect(const float& start, const float& stop, const line& ll) const {
+    template <class Line>
+    size_t findOverlappingIntersect(const Scalar& start, const Scalar& stop, const Line& ll) const {
         size_t result = 0;
-        vec2 g = vec2();
+        typename Line::vector_type g;
         visit_overlapping(start, stop,
-                          [&](const Interval<float, segment*>& interval) {
+                          [&](const interval& interval) {
+                                IRM_COUNT(candidates, 1);
                                 result += ll.intersect(*interval.value, g) ? 1 : 0;
                           });
+        IRM_COUNT(hits, result);
         return result;
     }
 
+    // Persistent updates: both return a new root that shares every node off
+    // the path to the node holding ival with the original tree, which is left
+    // untouched. New intervals are stored in the deepest existing node they
+    // fit in, so the tree stays valid without rebalancing.
+    static const_ptr insert(const const_ptr& root, const interval& ival) {
+        if (!root) {
+            IntervalTree* leaf = new IntervalTree();
+            leaf->center = (ival.start + ival.stop) / 2;
+            leaf->intervals = std::make_shared<const interval_vector>(1, ival);
+            return const_ptr(leaf);
+        }
+
+        std::shared_ptr<IntervalTree> node(new IntervalTree(*root));
+        if (ival.stop < root->center && root->left) {
+            node->left = insert(root->left, ival);
+        } else if (ival.start > root->center && root->right) {
+            node->right = insert(root->right, ival);
+        } else {
+            interval_vector ivals;
+            if (root->intervals) {
+                ivals = *root->intervals;
+            }
+            ivals.insert(std::upper_bound(ivals.begin(), ivals.end(), ival, IntervalStartCmp()), ival);
+            node->intervals = std::make_shared<const interval_vector>(std::move(ivals));
+        }
+        return node;
+    }
+
+    // Nodes entered and intervals looked at by visit_near(start, stop),
+    // added to nodes and scanned
+    void cost_near(const Scalar& start, const Scalar& stop, std::size_t& nodes, std::size_t& scanned) const {
+        ++nodes;
+        if (intervals && ! (stop < intervals->front().start)) {
+            scanned += intervals->size();
+        }
+        if (left && start <= center) {
+            left->cost_near(start, stop, nodes, scanned);
+        }
+        if (right && stop >= center) {
+            right->cost_near(start, stop, nodes, scanned);
+        }
+    }
+
+    // Approximate heap footprint of a shared_ptr control block (vtable and
+    // the use and weak counts), not counting allocator headers
+    static const std::size_t shared_overhead = 3 * sizeof(void*);
+
+    struct tree_stats {
+        std::size_t nodes;
+        std::size_t intervals;
+        std::size_t depth;
+        std::size_t node_bytes;
+        std::size_t interval_bytes;
+        std::size_t slack_bytes;
+        double total_width;
+    };
+
+    // Walks the whole tree; nodes shared with other trees are counted too
+    tree_stats stats() const {
+        tree_stats s = tree_stats();
+        s.nodes = 1;
+        s.node_bytes = sizeof(IntervalTree) + shared_overhead;
+
+        if (intervals) {
+            s.intervals = intervals->size();
+            s.interval_bytes = sizeof(interval_vector) + shared_overhead + sizeof(interval) * intervals->size();
+            s.slack_bytes = sizeof(interval) * (intervals->capacity() - intervals->size());
+            for (const interval& i : *intervals) {
+                s.total_width += (double)(i.stop - i.start);
+            }
+        }
+
+        std::size_t below = 0;
+        const IntervalTree* children[] = { left.get(), right.get() };
+        for (const IntervalTree* child : children) {
+            if (!child) {
+                continue;
+            }
+            tree_stats c = child->stats();
+            s.nodes += c.nodes;
+            s.intervals += c.intervals;
+            s.node_bytes += c.node_bytes;
+            s.interval_bytes += c.interval_bytes;
+            s.slack_bytes += c.slack_bytes;
+            s.total_width += c.total_width;
+            below = std::max(below, c.depth);
+        }
+        s.depth = below + 1;
+
+        return s;
+    }
+
+    // Removes one interval with the same bounds and value as ival. The result
+    // is never null; found reports whether a matching interval existed.
+    static const_ptr remove(const const_ptr& root, const interval& ival, bool& found) {
+        found = false;
+        const_ptr res = erase(root, ival, found);
+        return res ? res : const_ptr(new IntervalTree());
+    }
+
     // END MODIFIED
 
     interval_vector findContained(const Scalar& start, const Scalar& stop) const {
@@ -267,7 +375,7 @@ public:
         if (left && !left->empty()) {
             return false;
         }
-        if (!intervals.empty()) {
+        if (intervals) {
             return false;
         }
         if (right && !right->empty()) {
@@ -281,7 +389,9 @@ public:
         if (left) {
             left->visit_all(f);
         }
-        std::for_each(intervals.begin(), intervals.end(), f);
+        if (intervals) {
+            std::for_each(intervals->begin(), intervals->end(), f);
+        }
         if (right) {
             right->visit_all(f);
         }
@@ -305,6 +415,8 @@ public:
     // Check all constraints.
     // If first is false, second is invalid.
     std::pair<bool, std::pair<Scalar, Scalar>> is_valid() const {
+        static const interval_vector none;
+        const interval_vector& intervals = this->intervals ? *this->intervals : none;
         const auto minmaxStop = std::minmax_element(intervals.begin(), intervals.end(),
                                                     IntervalStopCmp());
         const auto minmaxStart = std::minmax_element(intervals.begin(), intervals.end(),
@@ -352,9 +464,9 @@ public:
                                   std::size_t depth = 0) {
         auto pad = [&]() { for (std::size_t i = 0; i != depth; ++i) { os << ' '; } };
         pad(); os << "center: " << itree.center << '\n';
-        for (const interval & inter : itree.intervals) {
+        itree.visit_node([&](const interval & inter) {
             pad(); os << inter << '\n';
-        }
+        });
         if (itree.left) {
             pad(); os << "left:\n";
             writeOut(os, *itree.left, depth + 1);
@@ -371,9 +483,56 @@ public:
     }
 
 private:
-    interval_vector intervals;
-    std::unique_ptr<IntervalTree> left;
-    std::unique_ptr<IntervalTree> right;
+    // MODIFIED
+
+    template <class UnaryFunction>
+    void visit_node(UnaryFunction f) const {
+        if (intervals) {
+            std::for_each(intervals->begin(), intervals->end(), f);
+        }
+    }
+
+    static const_ptr erase(const const_ptr& root, const interval& ival, bool& found) {
+        if (!root) {
+            return root;
+        }
+
+        std::shared_ptr<IntervalTree> node(new IntervalTree(*root));
+        if (ival.stop < root->center && root->left) {
+            node->left = erase(root->left, ival, found);
+        } else if (ival.start > root->center && root->right) {
+            node->right = erase(root->right, ival, found);
+        } else if (root->intervals) {
+            const interval_vector& ivals = *root->intervals;
+            auto range = std::equal_range(ivals.begin(), ivals.end(), ival, IntervalStartCmp());
+            for (auto i = range.first; i != range.second; ++i) {
+                if (i->stop == ival.stop && i->value == ival.value) {
+                    interval_vector rest(ivals.begin(), i);
+                    rest.insert(rest.end(), i + 1, ivals.end());
+                    if (rest.empty()) {
+                        node->intervals.reset();
+                    } else {
+                        node->intervals = std::make_shared<const interval_vector>(std::move(rest));
+                    }
+                    found = true;
+                    break;
+                }
+            }
+        }
+
+        if (!found) {
+            return root;
+        }
+        if (!node->intervals && !node->left && !node->right) {
+            return nullptr;
+        }
+        return node;
+    }
+
+    std::shared_ptr<const interval_vector> intervals;
+    const_ptr left;
+    const_ptr right;
+    // END MODIFIED
     Scalar center;
 };
 #ifdef USE_INTERVAL_TREE_NAMESPACE
@@ -0,0 +1,440 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+
+#include <IRM.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define IRM_PAGED 1
+#endif
+
+#ifndef PAGED_IRM_HPP
+#define PAGED_IRM_HPP
+
+#ifdef IRM_PAGED
+
+// Read-only, disk backed IRM for scenes whose k buckets don't fit in memory.
+// PagedIRM::write lays every bucket out as its own page aligned region of
+// intervals sorted by start, each carrying its segment inline, so a query
+// reads nothing but the one bucket it lands in. After the intervals come,
+// per block of BLOCK of them, the largest stop of the block and the largest
+// stop up to and including it: a stab binary searches the running maxima for
+// the first block that can reach it and skips blocks whose own maximum
+// falls short, so a few long intervals don't make every stab scan the
+// bucket. An opened PagedIRM maps a bucket on its first query and unmaps
+// the least recently used ones once the mapped bytes exceed the memory
+// budget.
+//
+// The file uses the native byte order and float layout. Queries may run
+// concurrently: a bucket evicted while being scanned stays mapped until the
+// scan ends.
+class PagedIRM
+{
+public:
+
+    static const unsigned int BLOCK = 64;
+
+    // One interval of a bucket and the segment it came from
+    struct Record
+    {
+        float start, stop;
+        float ax, ay, bx, by;
+
+        // Index of the segment in the list given to write
+        uint32_t id;
+    };
+
+    struct Stats
+    {
+        Stats() : loads(0), evictions(0), resident(0), peak(0) {}
+
+        size_t loads, evictions;
+
+        // Bytes mapped now and at most
+        size_t resident, peak;
+    };
+
+    PagedIRM() : fd(-1), k(0), scale(0.0F), budget(0), clock(0) {}
+
+    ~PagedIRM()
+    {
+        close();
+    }
+
+    PagedIRM(const PagedIRM&) = delete;
+    PagedIRM& operator=(const PagedIRM&) = delete;
+
+    // Builds the buckets of segs one at a time and writes them to path
+    static bool write(const std::string& path, unsigned int k, const std::vector<segment>& segs, std::string& error)
+    {
+        if(k == 0)
+        {
+            error = "k must be positive";
+            return false;
+        }
+
+        FILE* f = std::fopen(path.c_str(), "wb");
+        if(!f)
+        {
+            error = "cannot create " + path;
+            return false;
+        }
+
+        const size_t page = pageSize();
+        const std::vector<BucketBound<float>> bounds = bucketBounds<float>(k);
+
+        Header h = Header();
+        std::memcpy(h.magic, magic(), sizeof(h.magic));
+        h.k = k;
+        h.segments = segs.size();
+
+        std::vector<Directory> dir(k);
+        uint64_t offset = roundUp(sizeof(Header) + sizeof(Directory) * k, page);
+
+        bool ok = std::fseek(f, (long)(offset), SEEK_SET) == 0;
+
+        std::vector<Record> records;
+        for(unsigned int i = 0; ok && i < k; i++)
+        {
+            records.clear();
+            records.reserve(segs.size());
+
+            for(size_t u = 0; u < segs.size(); u++)
+            {
+                const segment& s = segs[u];
+                vec2 a = projectedRange(bounds[i], bounds[i + 1], s.a), b = projectedRange(bounds[i], bounds[i + 1], s.b);
+
+                Record r = { std::min(a.x, b.x), std::max(a.y, b.y), s.a.x, s.a.y, s.b.x, s.b.y, (uint32_t)(u) };
+                records.push_back(r);
+            }
+
+            std::sort(records.begin(), records.end(), [](const Record& x, const Record& y) { return x.start < y.start; });
+
+            // Largest stop of each block, then the running maximum
+            const size_t blocks = blockCount(records.size());
+            std::vector<float> maxima(2 * blocks, -INF);
+            for(size_t u = 0; u < records.size(); u++)
+                maxima[u / BLOCK] = std::max(maxima[u / BLOCK], records[u].stop);
+            for(size_t b = 0; b < blocks; b++)
+                maxima[blocks + b] = std::max(maxima[b], b == 0 ? -INF : maxima[blocks + b - 1]);
+
+            dir[i].offset = offset;
+            dir[i].count = records.size();
+
+            const size_t bytes = regionBytes(records.size());
+            ok = std::fwrite(records.data(), sizeof(Record), records.size(), f) == records.size();
+            ok = ok && std::fwrite(maxima.data(), sizeof(float), maxima.size(), f) == maxima.size();
+
+            // Pad to the next page so every bucket can be mapped on its own
+            uint64_t next = roundUp(offset + bytes, page);
+            std::vector<char> pad((size_t)(next - offset - bytes), 0);
+            ok = ok && std::fwrite(pad.data(), 1, pad.size(), f) == pad.size();
+            offset = next;
+        }
+
+        ok = ok && std::fseek(f, 0, SEEK_SET) == 0;
+        ok = ok && std::fwrite(&h, sizeof(h), 1, f) == 1;
+        ok = ok && std::fwrite(dir.data(), sizeof(Directory), k, f) == k;
+        ok = std::fclose(f) == 0 && ok;
+
+        if(!ok)
+            error = "cannot write " + path;
+        return ok;
+    }
+
+    // Reads the directory of path; buckets are only mapped when queried.
+    // Every bucket region must lie within the file, as touching a mapped
+    // page past its end would raise SIGBUS.
+    bool open(const std::string& path, size_t memoryBudget, std::string& error)
+    {
+        close();
+
+        fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+        {
+            error = "cannot open " + path;
+            return false;
+        }
+
+        struct stat st;
+        Header h;
+        if(::fstat(fd, &st) != 0 || ::pread(fd, &h, sizeof(h), 0) != (ssize_t)(sizeof(h)) || std::memcmp(h.magic, magic(), sizeof(h.magic)) != 0 || h.k == 0)
+        {
+            error = path + " is not a paged IRM file";
+            close();
+            return false;
+        }
+
+        const uint64_t fileSize = (uint64_t)(st.st_size);
+        if(h.k > (fileSize - sizeof(Header)) / sizeof(Directory))
+        {
+            error = path + " is truncated";
+            close();
+            return false;
+        }
+
+        dir.resize(h.k);
+        const size_t bytes = sizeof(Directory) * h.k;
+        if(::pread(fd, dir.data(), bytes, sizeof(Header)) != (ssize_t)(bytes))
+        {
+            error = path + " is truncated";
+            close();
+            return false;
+        }
+
+        for(const Directory& d : dir)
+        {
+            if(d.offset % pageSize() != 0 || d.offset > fileSize || d.count > (fileSize - d.offset) / sizeof(Record) || regionBytes(d.count) > fileSize - d.offset)
+            {
+                error = path + " is truncated or corrupt";
+                close();
+                return false;
+            }
+        }
+
+        k = h.k;
+        scale = (float)((double)(k) / scalar_traits<double>::pi());
+        budget = memoryBudget;
+        regions.assign(k, std::shared_ptr<Region>());
+        lru.assign(k, 0);
+        probes.assign(k, QueryCounters());
+        return true;
+    }
+
+    void close()
+    {
+        regions.clear();
+        dir.clear();
+        stats = Stats();
+
+        if(fd >= 0)
+            ::close(fd);
+        fd = -1;
+    }
+
+    // Evicts right away if the mapped buckets exceed the new budget
+    void setBudget(size_t memoryBudget)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = memoryBudget;
+
+        while(stats.resident > budget && evict(k)) {}
+    }
+
+    inline unsigned int buckets() const
+    {
+        return k;
+    }
+
+    // Bytes of all bucket regions, i.e. the budget that never evicts
+    size_t fileBytes() const
+    {
+        size_t res = 0;
+        for(const Directory& d : dir)
+            res += roundUp(regionBytes(d.count), pageSize());
+        return res;
+    }
+
+    Stats statistics()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+    inline const std::vector<QueryCounters>& counters() const
+    {
+        return probes;
+    }
+
+    size_t querySize(const line& l)
+    {
+        size_t res = 0;
+        visit(l, [&](const Record&) { res++; });
+        return res;
+    }
+
+    // Ids of the intersected segments
+    std::vector<uint32_t> query(const line& l)
+    {
+        std::vector<uint32_t> res;
+        visit(l, [&](const Record& r) { res.push_back(r.id); });
+        return res;
+    }
+
+private:
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t k, reserved;
+        uint64_t segments;
+    };
+
+    struct Directory
+    {
+        uint64_t offset, count;
+    };
+
+    // A mapped bucket, unmapped when the last query using it lets go
+    struct Region
+    {
+        Region(void* data, size_t bytes) : data(data), bytes(bytes) {}
+
+        ~Region()
+        {
+            ::munmap(data, bytes);
+        }
+
+        void* data;
+        size_t bytes;
+    };
+
+    static const char* magic()
+    {
+        return "IRMPAGE2";
+    }
+
+    static inline size_t blockCount(size_t count)
+    {
+        return (count + BLOCK - 1) / BLOCK;
+    }
+
+    // Intervals and the two maxima per block
+    static inline size_t regionBytes(size_t count)
+    {
+        return sizeof(Record) * count + 2 * sizeof(float) * blockCount(count);
+    }
+
+    static size_t pageSize()
+    {
+        return (size_t)(::sysconf(_SC_PAGESIZE));
+    }
+
+    static uint64_t roundUp(uint64_t v, uint64_t page)
+    {
+        return (v + page - 1) / page * page;
+    }
+
+    // Maps bucket n if needed, evicting cold buckets to respect the budget
+    std::shared_ptr<Region> acquire(unsigned int n)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        lru[n] = ++clock;
+
+        if(regions[n])
+            return regions[n];
+
+        const size_t bytes = roundUp(regionBytes(dir[n].count), pageSize());
+        if(bytes == 0)
+            return std::shared_ptr<Region>();
+
+        while(stats.resident + bytes > budget && evict(n)) {}
+
+        int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+        flags |= MAP_POPULATE;
+#endif
+        void* data = ::mmap(nullptr, bytes, PROT_READ, flags, fd, (off_t)(dir[n].offset));
+        if(data == MAP_FAILED)
+            throw std::runtime_error("cannot map bucket " + std::to_string(n));
+
+        regions[n] = std::make_shared<Region>(data, bytes);
+        stats.loads++;
+        stats.resident += bytes;
+        stats.peak = std::max(stats.peak, stats.resident);
+        return regions[n];
+    }
+
+    // Drops the least recently used mapped bucket other than keep
+    bool evict(unsigned int keep)
+    {
+        unsigned int victim = k;
+        for(unsigned int i = 0; i < k; i++)
+            if(regions[i] && i != keep && (victim == k || lru[i] < lru[victim]))
+                victim = i;
+
+        if(victim == k)
+            return false;
+
+        stats.resident -= regions[victim]->bytes;
+        stats.evictions++;
+        regions[victim].reset();
+        return true;
+    }
+
+    template <class UnaryFunction>
+    void visit(const line& l, UnaryFunction f)
+    {
+        float angle = IRM::lineToTransformAngle(l);
+        float x = IRM::transformLine(l);
+        unsigned int n = std::min((unsigned int)(std::floor(angle * scale)), k - 1);
+        IRM_PROBE(n);
+
+        std::shared_ptr<Region> region = acquire(n);
+        if(!region)
+            return;
+
+        const size_t count = dir[n].count, blocks = blockCount(count);
+        const Record* records = (const Record*)(region->data);
+        const float* blockMax = (const float*)(records + count);
+        const float* runningMax = blockMax + blocks;
+
+        // No block before the first whose running maximum reaches lo holds
+        // an interval overlapping [lo, hi]
+        const float lo = x - EPSILON, hi = x + EPSILON;
+        size_t b = (size_t)(std::lower_bound(runningMax, runningMax + blocks, lo) - runningMax);
+
+        vec2 tmp;
+        for(; b < blocks && records[b * BLOCK].start <= hi; b++)
+        {
+            IRM_COUNT(nodes, 1);
+            if(blockMax[b] < lo)
+                continue;
+
+            const Record* end = records + std::min(count, (b + 1) * BLOCK);
+            for(const Record* r = records + b * BLOCK; r != end && r->start <= hi; r++)
+            {
+                IRM_COUNT(scanned, 1);
+                if(r->stop < lo)
+                    continue;
+
+                IRM_COUNT(candidates, 1);
+                if(l.intersect(segment(vec2(r->ax, r->ay), vec2(r->bx, r->by)), tmp))
+                {
+                    IRM_COUNT(hits, 1);
+                    f(*r);
+                }
+            }
+        }
+    }
+
+    int fd;
+    unsigned int k;
+    float scale;
+    size_t budget;
+
+    std::vector<Directory> dir;
+
+    // Mapped buckets and the tick of their last use
+    std::vector<std::shared_ptr<Region>> regions;
+    std::vector<uint64_t> lru;
+    uint64_t clock;
+
+    std::mutex mutex;
+    Stats stats;
+    std::vector<QueryCounters> probes;
+};
+
+#endif // IRM_PAGED
+
+#endif // PAGED_IRM_HPP
@@ -0,0 +1,400 @@
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include <IRM.hpp>
+
+#ifndef POLYLINE_IRM_HPP
+#define POLYLINE_IRM_HPP
+
+// A chain of edges between consecutive points, closed back to the first
+// point for polygons, with an optional payload like basic_segment
+template <class T, class P = void>
+struct basic_polyline
+{
+    std::vector<basic_vec2<T>> points;
+    bool closed;
+    P payload;
+
+    basic_polyline(const std::vector<basic_vec2<T>>& points, bool closed = false, P payload = P()) : points(points), closed(closed), payload(payload) {}
+
+    // A closed shape of two points has its one edge only once
+    inline size_t edges() const
+    {
+        return points.size() < 2 ? 0 : (closed && points.size() > 2 ? points.size() : points.size() - 1);
+    }
+
+    inline basic_segment<T> edge(size_t i) const
+    {
+        return basic_segment<T>(points[i], points[(i + 1) % points.size()]);
+    }
+};
+
+template <class T>
+struct basic_polyline<T, void>
+{
+    std::vector<basic_vec2<T>> points;
+    bool closed;
+
+    basic_polyline(const std::vector<basic_vec2<T>>& points, bool closed = false) : points(points), closed(closed) {}
+
+    // A closed shape of two points has its one edge only once
+    inline size_t edges() const
+    {
+        return points.size() < 2 ? 0 : (closed && points.size() > 2 ? points.size() : points.size() - 1);
+    }
+
+    inline basic_segment<T> edge(size_t i) const
+    {
+        return basic_segment<T>(points[i], points[(i + 1) % points.size()]);
+    }
+};
+
+typedef basic_polyline<float> polyline;
+
+// IRM over polylines and polygons. Within each bucket, consecutive edges of
+// a shape are grouped into runs that share one interval (the union of their
+// projected extents) as long as the union stays tight, so a connected shape
+// stores far fewer than k intervals per edge. A query stabs the runs, tests
+// their edges and reports each shape once together with its crossing edges.
+template <class Scalar = float, class Payload = void>
+class BasicPolylineIRM
+{
+public:
+
+    typedef basic_polyline<Scalar, Payload> shape_type;
+    typedef basic_line<Scalar> line_type;
+    typedef basic_vec2<Scalar> vec2_type;
+
+    // Edges [first, first + count) of a shape
+    struct Run
+    {
+        uint32_t shape, first, count;
+
+        bool operator==(const Run& o) const
+        {
+            return shape == o.shape && first == o.first && count == o.count;
+        }
+    };
+
+    typedef Interval<Scalar, Run> interval;
+    typedef IntervalTree<Scalar, Run> tree;
+
+    struct Hit
+    {
+        size_t shape;
+        std::vector<size_t> edges;
+    };
+
+    BasicPolylineIRM(unsigned int k, const std::vector<shape_type>& s) :
+        k(k), scale((Scalar)((double)(k) / scalar_traits<double>::pi())), bounds(bucketBounds<Scalar>(k)), live(0)
+    {
+        assert(k != 0);
+
+        resetCounters();
+
+        for(const shape_type& p : s)
+            add(p);
+
+        generate();
+    }
+
+    // Live shapes
+    inline size_t count() const
+    {
+        return live;
+    }
+
+    inline const shape_type& at(size_t id) const
+    {
+        return shapes[id];
+    }
+
+    inline unsigned int buckets() const
+    {
+        return k;
+    }
+
+    inline const std::vector<QueryCounters>& counters() const
+    {
+        return probes;
+    }
+
+    inline void resetCounters()
+    {
+        probes.assign(k, QueryCounters());
+    }
+
+    struct Stats
+    {
+        // Intervals stored over all buckets and the edges they cover
+        size_t intervals, edges;
+        size_t nodeBytes, intervalBytes, shapeBytes;
+
+        inline size_t bytes() const
+        {
+            return nodeBytes + intervalBytes + shapeBytes;
+        }
+    };
+
+    Stats statistics() const
+    {
+        Stats res = Stats();
+
+        for(size_t id = 0; id < shapes.size(); id++)
+        {
+            res.edges += removed[id] ? 0 : shapes[id].edges() * k;
+            res.shapeBytes += sizeof(shape_type) + sizeof(vec2_type) * shapes[id].points.capacity();
+        }
+
+        for(const auto& b : t)
+        {
+            typename tree::tree_stats ts = b->stats();
+            res.intervals += ts.intervals;
+            res.nodeBytes += ts.node_bytes;
+            res.intervalBytes += ts.interval_bytes + ts.slack_bytes;
+        }
+
+        return res;
+    }
+
+    // Returns the id of the new shape
+    size_t insert(const shape_type& p)
+    {
+        return insert(std::vector<shape_type>(1, p));
+    }
+
+    // Returns the id of the first new shape, the others follow in order
+    size_t insert(const std::vector<shape_type>& s)
+    {
+        const size_t first = shapes.size();
+
+        for(const shape_type& p : s)
+            add(p);
+
+        // Large batches are cheaper to bulk load than to insert one by one
+        if(s.size() * REBUILD_RATIO > live)
+        {
+            generate();
+            return first;
+        }
+
+        for(unsigned int i = 0; i < k; i++)
+            for(size_t id = first; id < shapes.size(); id++)
+                runs(i, id, [&](const interval& iv) { t[i] = tree::insert(t[i], iv); });
+
+        return first;
+    }
+
+    void remove(size_t id)
+    {
+        assert(!removed[id]);
+
+        for(unsigned int i = 0; i < k; i++)
+        {
+            runs(i, id, [&](const interval& iv)
+            {
+                bool found;
+                t[i] = tree::remove(t[i], iv, found);
+                assert(found);
+            });
+        }
+
+        removed[id] = true;
+        live--;
+    }
+
+    // Number of shapes l crosses
+    size_t querySize(const line_type& l)
+    {
+        std::vector<uint32_t> ids;
+        crossings(l, [&](uint32_t shape, uint32_t) { ids.push_back(shape); });
+
+        std::sort(ids.begin(), ids.end());
+        return (size_t)(std::unique(ids.begin(), ids.end()) - ids.begin());
+    }
+
+    // Number of edges l crosses, as many as a segment IRM of every edge finds
+    size_t queryEdges(const line_type& l)
+    {
+        size_t res = 0;
+        crossings(l, [&](uint32_t, uint32_t) { res++; });
+        return res;
+    }
+
+    // One hit per shape, by increasing id, with its crossing edges in order
+    std::vector<Hit> query(const line_type& l)
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> edges;
+        crossings(l, [&](uint32_t shape, uint32_t e) { edges.push_back(std::make_pair(shape, e)); });
+        std::sort(edges.begin(), edges.end());
+
+        std::vector<Hit> res;
+        for(const auto& e : edges)
+        {
+            if(res.empty() || res.back().shape != e.first)
+                res.push_back(Hit{ e.first, std::vector<size_t>() });
+            res.back().edges.push_back(e.second);
+        }
+        return res;
+    }
+
+private:
+
+    // A run may grow while its interval width times its edge count stays
+    // within MERGE_SLACK times the summed widths of its edges, i.e. while a
+    // stab of the run costs at most about twice the edge tests that separate
+    // intervals would have cost. MAX_RUN bounds the edges tested per stab.
+    static constexpr Scalar MERGE_SLACK = 2;
+    static const uint32_t MAX_RUN = 16;
+
+    // Batches over 1 / REBUILD_RATIO of the live shapes trigger a rebuild
+    static const size_t REBUILD_RATIO = 4;
+
+    typedef scalar_traits<Scalar> traits;
+
+    void generate()
+    {
+        t.clear();
+
+        for(unsigned int i = 0; i < k; i++)
+        {
+            std::vector<interval> tmp;
+            for(size_t id = 0; id < shapes.size(); id++)
+                if(!removed[id])
+                    runs(i, id, [&](const interval& iv) { tmp.push_back(iv); });
+
+            t.push_back(std::make_shared<const tree>(std::move(tmp)));
+        }
+    }
+
+    size_t add(const shape_type& p)
+    {
+        shapes.push_back(p);
+        removed.push_back(false);
+        live++;
+        return shapes.size() - 1;
+    }
+
+    // Calls f with every run interval of shape id in bucket i. Deterministic,
+    // so remove finds exactly the intervals that were inserted.
+    template <class UnaryFunction>
+    void runs(unsigned int i, size_t id, UnaryFunction f) const
+    {
+        const shape_type& p = shapes[id];
+        const size_t edges = p.edges();
+        if(edges == 0)
+            return;
+
+        std::vector<vec2_type> ranges;
+        ranges.reserve(p.points.size());
+        for(const vec2_type& v : p.points)
+            ranges.push_back(projectedRange(bounds[i], bounds[i + 1], v));
+
+        Run run = { (uint32_t)(id), 0, 0 };
+        Scalar lo = 0, hi = 0, sum = 0;
+
+        for(uint32_t e = 0; e < edges; e++)
+        {
+            const vec2_type& a = ranges[e];
+            const vec2_type& b = ranges[(e + 1) % ranges.size()];
+            Scalar elo = std::min(a.x, b.x), ehi = std::max(a.y, b.y);
+
+            if(run.count != 0)
+            {
+                Scalar nlo = std::min(lo, elo), nhi = std::max(hi, ehi);
+                Scalar nsum = sum + (ehi - elo);
+
+                if(run.count < MAX_RUN && (nhi - nlo) * (Scalar)(run.count + 1) <= MERGE_SLACK * nsum + traits::epsilon())
+                {
+                    lo = nlo;
+                    hi = nhi;
+                    sum = nsum;
+                    run.count++;
+                    continue;
+                }
+
+                f(interval(lo, hi, run));
+            }
+
+            run.first = e;
+            run.count = 1;
+            lo = elo;
+            hi = ehi;
+            sum = ehi - elo;
+        }
+
+        f(interval(lo, hi, run));
+    }
+
+    // Calls f(shape, edge) for every edge of a stabbed run that l crosses
+    template <class BinaryFunction>
+    void crossings(const line_type& l, BinaryFunction f)
+    {
+        Scalar angle = BasicIRM<Scalar>::lineToTransformAngle(l);
+        Scalar offset = BasicIRM<Scalar>::transformLine(l);
+
+        unsigned int n = std::min((unsigned int)(std::floor(angle * scale)), k - 1);
+        IRM_PROBE(n);
+
+        vec2_type tmp;
+        t[n]->visit_overlapping(offset - traits::epsilon(), offset + traits::epsilon(), [&](const interval& iv)
+        {
+            // Every edge of the run is tested, like one IRM candidate each
+            const shape_type& p = shapes[iv.value.shape];
+            IRM_COUNT(candidates, iv.value.count);
+
+            for(uint32_t e = iv.value.first; e < iv.value.first + iv.value.count; e++)
+            {
+                if(l.intersect(p.edge(e), tmp))
+                {
+                    IRM_COUNT(hits, 1);
+                    f(iv.value.shape, e);
+                }
+            }
+        });
+    }
+
+    unsigned int k;
+    Scalar scale;
+    std::vector<BucketBound<Scalar>> bounds;
+    std::vector<typename tree::const_ptr> t;
+
+    // Shapes keep their ids; removed ones stay as tombstones
+    std::vector<shape_type> shapes;
+    std::vector<bool> removed;
+    size_t live;
+
+    std::vector<QueryCounters> probes;
+};
+
+template <class Scalar, class Payload>
+constexpr Scalar BasicPolylineIRM<Scalar, Payload>::MERGE_SLACK;
+
+typedef BasicPolylineIRM<float> PolylineIRM;
+
+// Joins runs of consecutive segments where each starts at the end of the
+// previous one into polylines, closed when the run returns to its start
+static inline std::vector<polyline> chainsOf(const std::vector<segment>& segs)
+{
+    std::vector<polyline> res;
+
+    for(size_t i = 0; i < segs.size();)
+    {
+        std::vector<vec2> points(1, segs[i].a);
+        size_t j = i;
+        for(; j < segs.size() && (j == i || (segs[j].a.x == segs[j - 1].b.x && segs[j].a.y == segs[j - 1].b.y)); j++)
+            points.push_back(segs[j].b);
+
+        bool closed = j - i > 2 && points.back().x == points.front().x && points.back().y == points.front().y;
+        if(closed)
+            points.pop_back();
+
+        res.push_back(polyline(points, closed));
+        i = j;
+    }
+
+    return res;
+}
+
+#endif // POLYLINE_IRM_HPP
@@ -0,0 +1,102 @@
+#include <cmath>
+#include <limits>
+
+#include <Geometry.hpp>
+#include <Counters.hpp>
+
+#ifndef PREDICATES_HPP
+#define PREDICATES_HPP
+
+// Filtered side-of-line predicate. The sign of y - (slope * x + offset) is
+// first evaluated in the input precision together with a bound on its
+// rounding error; only when the value lies within that bound is it
+// recomputed exactly with floating point expansions (Shewchuk, "Adaptive
+// Precision Floating-Point Arithmetic and Fast Robust Geometric
+// Predicates"). Overflow and underflow are not handled.
+
+// a + b == s + e exactly
+static inline void twoSum(double a, double b, double& s, double& e)
+{
+    s = a + b;
+    double bv = s - a;
+    double av = s - bv;
+    e = (a - av) + (b - bv);
+}
+
+// Exact sign of y - (slope * x + offset)
+static inline int exactSide(double y, double slope, double x, double offset)
+{
+    double p = slope * x;
+    double terms[4] = { y, -p, -std::fma(slope, x, -p), -offset };
+
+    // Grow-Expansion: h stays a nonoverlapping expansion of the terms added
+    // so far, ordered by increasing magnitude
+    double h[4];
+    size_t len = 0;
+
+    for(double t : terms)
+    {
+        double q = t;
+        for(size_t i = 0; i < len; i++)
+            twoSum(q, h[i], q, h[i]);
+        h[len++] = q;
+    }
+
+    // The largest nonzero component decides the sign
+    for(size_t i = len; i > 0; i--)
+        if(h[i - 1] != 0.0)
+            return h[i - 1] > 0.0 ? 1 : -1;
+    return 0;
+}
+
+// 1 above the line, -1 below, 0 on it
+template <class T>
+static inline int sideOf(const basic_line<T>& l, const basic_vec2<T>& p)
+{
+    T mx = l.slope * p.x;
+    T f = p.y - (mx + l.offset);
+
+    // Three roundings, each within half an ulp of the magnitudes involved
+    T bound = (T)(2) * std::numeric_limits<T>::epsilon() * (std::fabs(p.y) + std::fabs(mx) + std::fabs(l.offset));
+
+    if(f > bound)
+        return 1;
+    if(f < -bound)
+        return -1;
+
+    IRM_COUNT(fallbacks, 1);
+    return exactSide((double)(p.y), (double)(l.slope), (double)(p.x), (double)(l.offset));
+}
+
+// Whether s touches l, with both end points classified exactly
+template <class T, class P>
+static inline bool crosses(const basic_line<T>& l, const basic_segment<T, P>& s)
+{
+    return sideOf(l, s.a) * sideOf(l, s.b) <= 0;
+}
+
+// A line whose intersect uses the filtered predicate. It can stand in for
+// basic_line wherever only intersect is called (IntervalTree, SegmentBuffer).
+template <class T>
+struct robust_line : basic_line<T>
+{
+    robust_line(const basic_line<T>& l) : basic_line<T>(l) {}
+
+    template <class P>
+    bool intersect(const basic_segment<T, P>& s, basic_vec2<T>& point) const
+    {
+        if(!crosses(*this, s))
+            return false;
+
+        // The decision is exact, the reported point is only approximate
+        double fa = (double)(s.a.y) - ((double)(this->slope) * (double)(s.a.x) + (double)(this->offset));
+        double fb = (double)(s.b.y) - ((double)(this->slope) * (double)(s.b.x) + (double)(this->offset));
+        double t = fa == fb ? 0.0 : fa / (fa - fb);
+
+        point = basic_vec2<T>((T)((double)(s.a.x) + t * ((double)(s.b.x) - (double)(s.a.x))),
+                              (T)((double)(s.a.y) + t * ((double)(s.b.y) - (double)(s.a.y))));
+        return true;
+    }
+};
+
+#endif // PREDICATES_HPP
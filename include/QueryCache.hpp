@@ -0,0 +1,222 @@
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+
+#include <IRM.hpp>
+
+#ifndef QUERY_CACHE_HPP
+#define QUERY_CACHE_HPP
+
+// Optional result cache in front of an IRM. Lines are keyed by the bucket
+// and projected offset the query computes anyway, quantized to a
+// configurable step, so repeated lines that land in the same cell reuse the
+// first result instead of redoing the tree traversal. The cache holds at
+// most capacity entries, evicts them with the CLOCK algorithm and is emptied
+// whenever the IRM changes.
+class QueryCache
+{
+public:
+
+    struct Stats
+    {
+        Stats() : hits(0), misses(0), evictions(0), invalidations(0), hitTime(0), missTime(0) {}
+
+        size_t hits, misses, evictions, invalidations;
+
+        // Total nanoseconds spent answering hits and misses
+        unsigned long int hitTime, missTime;
+
+        double hitRate() const
+        {
+            return hits + misses == 0 ? 0.0 : (double)(hits) / (double)(hits + misses);
+        }
+    };
+
+    // A step of 0 only lets exactly equal keys share an entry
+    QueryCache(IRM& irm, size_t capacity, float angleStep = 0.0F, float offsetStep = 0.0F) :
+        irm(irm), capacity(capacity), angleStep(angleStep), offsetStep(offsetStep), hand(0), generation(irm.generation())
+    {
+        assert(capacity != 0);
+        entries.reserve(capacity);
+        index.reserve(capacity);
+    }
+
+    size_t querySize(const line& l)
+    {
+        unsigned long int start = now();
+        Entry& e = lookup(l);
+
+        if(e.filled)
+        {
+            stats.hits++;
+            stats.hitTime += now() - start;
+            return e.count;
+        }
+
+        e.count = irm.querySize(l);
+        e.filled = true;
+
+        stats.misses++;
+        stats.missTime += now() - start;
+        return e.count;
+    }
+
+    std::vector<IRM::interval> query(const line& l)
+    {
+        unsigned long int start = now();
+        Entry& e = lookup(l);
+
+        if(e.hasHits)
+        {
+            stats.hits++;
+            stats.hitTime += now() - start;
+            return e.hits;
+        }
+
+        e.hits = irm.query(l);
+        e.count = e.hits.size();
+        e.filled = e.hasHits = true;
+
+        stats.misses++;
+        stats.missTime += now() - start;
+        return e.hits;
+    }
+
+    void clear()
+    {
+        entries.clear();
+        index.clear();
+        hand = 0;
+    }
+
+    inline size_t size() const
+    {
+        return entries.size();
+    }
+
+    inline const Stats& statistics() const
+    {
+        return stats;
+    }
+
+    inline void resetStatistics()
+    {
+        stats = Stats();
+    }
+
+private:
+
+    struct Key
+    {
+        unsigned int bucket;
+        int64_t angle, offset;
+
+        bool operator==(const Key& o) const
+        {
+            return bucket == o.bucket && angle == o.angle && offset == o.offset;
+        }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& k) const
+        {
+            uint64_t h = (uint64_t)(k.bucket) * 0x9E3779B97F4A7C15ULL;
+            h ^= (uint64_t)(k.angle) + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+            h ^= (uint64_t)(k.offset) + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+            return (size_t)(h);
+        }
+    };
+
+    struct Entry
+    {
+        Key key;
+        bool referenced, filled, hasHits;
+        size_t count;
+        std::vector<IRM::interval> hits;
+    };
+
+    static int64_t quantize(float v, float step)
+    {
+        if(step <= 0.0F)
+        {
+            // Use the bit pattern so equal floats map to the same cell
+            int32_t bits;
+            std::memcpy(&bits, &v, sizeof(bits));
+            return bits;
+        }
+
+        return (int64_t)(std::floor(v / step));
+    }
+
+    // Returns the entry for l, claiming a slot for it if it isn't cached
+    Entry& lookup(const line& l)
+    {
+        if(generation != irm.generation())
+        {
+            if(!entries.empty())
+                stats.invalidations++;
+
+            clear();
+            generation = irm.generation();
+        }
+
+        vec2 p(IRM::lineToTransformAngle(l), IRM::transformLine(l));
+
+        Key key;
+        key.bucket = irm.bucket(p.x);
+        key.angle = quantize(p.x, angleStep);
+        key.offset = quantize(p.y, offsetStep);
+
+        auto found = index.find(key);
+        if(found != index.end())
+        {
+            Entry& e = entries[found->second];
+            e.referenced = true;
+            return e;
+        }
+
+        size_t slot;
+        if(entries.size() < capacity)
+        {
+            slot = entries.size();
+            entries.push_back(Entry());
+        }
+        else
+        {
+            // CLOCK: skip recently used entries, clearing their bit
+            while(entries[hand].referenced)
+            {
+                entries[hand].referenced = false;
+                hand = (hand + 1) % capacity;
+            }
+
+            slot = hand;
+            hand = (hand + 1) % capacity;
+            index.erase(entries[slot].key);
+            stats.evictions++;
+        }
+
+        Entry& e = entries[slot];
+        e.key = key;
+        e.referenced = true;
+        e.filled = e.hasHits = false;
+        e.count = 0;
+        e.hits.clear();
+        index[key] = slot;
+
+        return e;
+    }
+
+    IRM& irm;
+    const size_t capacity;
+    const float angleStep, offsetStep;
+
+    size_t hand;
+    size_t generation;
+    std::vector<Entry> entries;
+    std::unordered_map<Key, size_t, KeyHash> index;
+    Stats stats;
+};
+
+#endif // QUERY_CACHE_HPP
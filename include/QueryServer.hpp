@@ -0,0 +1,501 @@
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+
+#include <IRM.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#define IRM_SERVER 1
+#endif
+
+#ifndef QUERY_SERVER_HPP
+#define QUERY_SERVER_HPP
+
+#ifdef IRM_SERVER
+
+// Wire format of the query server, native byte order. A client sends frames
+// of a uint32 count followed by that many Query records and may send more
+// before any reply arrives. The server answers with frames of the same
+// shape holding Reply records, matched to queries by id; the replies to one
+// frame may be split over several reply frames and come in any order.
+namespace wire
+{
+    struct Query
+    {
+        uint32_t id;
+        float slope, offset;
+    };
+
+    struct Reply
+    {
+        uint32_t id, hits;
+    };
+
+    // Largest frame either side accepts
+    static const uint32_t MAX_FRAME = 1 << 16;
+
+    static inline bool readFull(int fd, void* data, size_t bytes)
+    {
+        char* p = (char*)(data);
+        while(bytes != 0)
+        {
+            ssize_t n = ::recv(fd, p, bytes, 0);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                return false;
+
+            p += n;
+            bytes -= (size_t)(n);
+        }
+        return true;
+    }
+
+    static inline bool writeFull(int fd, const void* data, size_t bytes)
+    {
+        int flags = 0;
+#ifdef MSG_NOSIGNAL
+        flags = MSG_NOSIGNAL;
+#endif
+        const char* p = (const char*)(data);
+        while(bytes != 0)
+        {
+            ssize_t n = ::send(fd, p, bytes, flags);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                return false;
+
+            p += n;
+            bytes -= (size_t)(n);
+        }
+        return true;
+    }
+
+    template <class Record>
+    static bool writeFrame(int fd, const std::vector<Record>& records)
+    {
+        // One buffer, so frames of concurrent writers never interleave
+        std::vector<char> buffer(sizeof(uint32_t) + sizeof(Record) * records.size());
+        uint32_t count = (uint32_t)(records.size());
+        std::memcpy(buffer.data(), &count, sizeof(count));
+        if(!records.empty())
+            std::memcpy(buffer.data() + sizeof(count), records.data(), sizeof(Record) * records.size());
+
+        return writeFull(fd, buffer.data(), buffer.size());
+    }
+
+    template <class Record>
+    static bool readFrame(int fd, std::vector<Record>& records)
+    {
+        uint32_t count;
+        if(!readFull(fd, &count, sizeof(count)) || count > MAX_FRAME)
+            return false;
+
+        records.resize(count);
+        return count == 0 || readFull(fd, records.data(), sizeof(Record) * count);
+    }
+
+    static inline bool address(const std::string& path, sockaddr_un& addr, std::string& error)
+    {
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+
+        if(path.size() >= sizeof(addr.sun_path))
+        {
+            error = "socket path too long: " + path;
+            return false;
+        }
+
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        return true;
+    }
+}
+
+// Serves line queries against an index shared by several local processes,
+// over a Unix domain socket. One thread per connection reads query frames
+// into a common queue of at most MAX_QUEUE queries, and stops reading its
+// socket while the queue is full so fast clients are held back by their
+// socket buffers. Each worker takes up to MAX_BATCH queued queries
+// (from any connections), sorts them by line angle so queries of the same
+// bucket run back to back while its tree is in cache, answers them and
+// sends each connection its replies right away, without waiting for its
+// other queries. Index is IRM, PagedIRM or anything else with a
+// thread safe querySize(line); setIndex swaps it while serving.
+template <class Index = IRM>
+class QueryServer
+{
+public:
+
+    static const size_t MAX_BATCH = 256;
+    static const size_t MAX_QUEUE = 16 * MAX_BATCH;
+
+    struct Stats
+    {
+        uint64_t connections, queries, batches;
+
+        inline double averageBatch() const
+        {
+            return batches == 0 ? 0.0 : (double)(queries) / (double)(batches);
+        }
+    };
+
+    QueryServer(std::shared_ptr<Index> index, unsigned int workers) : index(index), workers(std::max(workers, 1U)), listener(-1), stopping(false)
+    {
+        counts.connections = counts.queries = counts.batches = 0;
+    }
+
+    ~QueryServer()
+    {
+        stop();
+    }
+
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+
+    // Listens on path, replacing a stale socket file
+    bool start(const std::string& path, std::string& error)
+    {
+        sockaddr_un addr;
+        if(!wire::address(path, addr, error))
+            return false;
+
+        listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if(listener < 0)
+        {
+            error = "cannot create a socket";
+            return false;
+        }
+
+        ::unlink(path.c_str());
+        if(::bind(listener, (const sockaddr*)(&addr), sizeof(addr)) != 0 || ::listen(listener, 64) != 0)
+        {
+            error = "cannot listen on " + path;
+            ::close(listener);
+            listener = -1;
+            return false;
+        }
+
+        socketPath = path;
+        stopping = false;
+
+        for(unsigned int w = 0; w < workers; w++)
+            threads.push_back(std::thread(&QueryServer::work, this));
+        threads.push_back(std::thread(&QueryServer::accept, this));
+        return true;
+    }
+
+    // Closes every connection and waits for all threads. Queries still
+    // queued are dropped without a reply.
+    void stop()
+    {
+        if(listener < 0)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+
+            for(const auto& c : connections)
+                ::shutdown(c->fd, SHUT_RDWR);
+        }
+
+        ::shutdown(listener, SHUT_RDWR);
+        ready.notify_all();
+        space.notify_all();
+
+        for(std::thread& t : threads)
+            t.join();
+
+        std::vector<std::thread> readers;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            readers.swap(this->readers);
+        }
+        for(std::thread& t : readers)
+            t.join();
+
+        threads.clear();
+        connections.clear();
+        finished.clear();
+        queue.clear();
+
+        ::close(listener);
+        ::unlink(socketPath.c_str());
+        listener = -1;
+    }
+
+    void setIndex(std::shared_ptr<Index> i)
+    {
+        std::atomic_store(&index, i);
+    }
+
+    Stats statistics()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counts;
+    }
+
+private:
+
+    struct Connection
+    {
+        Connection(int fd) : fd(fd) {}
+
+        ~Connection()
+        {
+            ::close(fd);
+        }
+
+        int fd;
+
+        // Serializes reply frames
+        std::mutex write;
+    };
+
+    struct Pending
+    {
+        std::shared_ptr<Connection> connection;
+        wire::Query query;
+        float angle;
+    };
+
+    void accept()
+    {
+        for(;;)
+        {
+            int fd = ::accept(listener, nullptr, nullptr);
+            if(fd < 0)
+            {
+                if(errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                return;
+            }
+
+            reap();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if(stopping)
+            {
+                ::close(fd);
+                return;
+            }
+
+            std::shared_ptr<Connection> c = std::make_shared<Connection>(fd);
+            connections.push_back(c);
+            counts.connections++;
+            readers.push_back(std::thread(&QueryServer::read, this, c));
+        }
+    }
+
+    // Joins the readers of closed connections, so a long running server
+    // only holds threads for the connections still open
+    void reap()
+    {
+        std::vector<std::thread> done;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for(size_t i = 0; i < readers.size();)
+            {
+                if(std::find(finished.begin(), finished.end(), readers[i].get_id()) == finished.end())
+                {
+                    i++;
+                    continue;
+                }
+
+                done.push_back(std::move(readers[i]));
+                readers[i] = std::move(readers.back());
+                readers.pop_back();
+            }
+            finished.clear();
+        }
+
+        // They only have to return, having let go of the lock
+        for(std::thread& t : done)
+            t.join();
+    }
+
+    void read(std::shared_ptr<Connection> c)
+    {
+        std::vector<wire::Query> frame;
+        while(wire::readFrame(c->fd, frame))
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            for(const wire::Query& q : frame)
+            {
+                // Once stopping, the socket is shut down and the next read fails
+                if(queue.size() >= MAX_QUEUE)
+                {
+                    ready.notify_one();
+                    space.wait(lock, [&]() { return stopping || queue.size() < MAX_QUEUE; });
+                    if(stopping)
+                        break;
+                }
+
+                Pending p = { c, q, IRM::lineToTransformAngle(line(q.slope, q.offset)) };
+                queue.push_back(p);
+            }
+            ready.notify_one();
+        }
+
+        // Let the connection close once its last replies are out
+        std::lock_guard<std::mutex> lock(mutex);
+        connections.erase(std::remove(connections.begin(), connections.end(), c), connections.end());
+        finished.push_back(std::this_thread::get_id());
+    }
+
+    void work()
+    {
+        std::vector<Pending> batch;
+        std::vector<wire::Reply> replies;
+
+        for(;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [&]() { return stopping || !queue.empty(); });
+                if(stopping)
+                    return;
+
+                const size_t n = std::min(queue.size(), (size_t)(MAX_BATCH));
+                batch.assign(queue.begin(), queue.begin() + n);
+                queue.erase(queue.begin(), queue.begin() + n);
+
+                counts.queries += n;
+                counts.batches++;
+
+                if(!queue.empty())
+                    ready.notify_one();
+            }
+
+            space.notify_all();
+
+            std::sort(batch.begin(), batch.end(), [](const Pending& a, const Pending& b) { return a.angle < b.angle; });
+
+            std::shared_ptr<Index> current = std::atomic_load(&index);
+            std::vector<uint32_t> hits(batch.size());
+            for(size_t i = 0; i < batch.size(); i++)
+                hits[i] = (uint32_t)(current->querySize(line(batch[i].query.slope, batch[i].query.offset)));
+
+            // One reply frame per connection in the batch
+            std::vector<size_t> order(batch.size());
+            for(size_t i = 0; i < order.size(); i++)
+                order[i] = i;
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return batch[a].connection < batch[b].connection; });
+
+            for(size_t i = 0; i < order.size();)
+            {
+                const std::shared_ptr<Connection>& c = batch[order[i]].connection;
+
+                replies.clear();
+                for(; i < order.size() && batch[order[i]].connection == c; i++)
+                    replies.push_back(wire::Reply{ batch[order[i]].query.id, hits[order[i]] });
+
+                std::lock_guard<std::mutex> lock(c->write);
+                wire::writeFrame(c->fd, replies);
+            }
+
+            batch.clear();
+        }
+    }
+
+    std::shared_ptr<Index> index;
+    unsigned int workers;
+
+    int listener;
+    std::string socketPath;
+
+    // Guards everything below
+    std::mutex mutex;
+    std::condition_variable ready, space;
+    bool stopping;
+
+    std::deque<Pending> queue;
+    std::vector<std::shared_ptr<Connection>> connections;
+    std::vector<std::thread> threads, readers;
+
+    // Readers that have returned and wait to be joined
+    std::vector<std::thread::id> finished;
+    Stats counts;
+};
+
+// Blocking client of QueryServer. Frames can be pipelined: send several
+// before receiving their replies. The server stops reading while its queue
+// is full, so a client sending much more than the socket buffers hold has
+// to receive from another thread meanwhile.
+class QueryClient
+{
+public:
+
+    QueryClient() : fd(-1) {}
+
+    ~QueryClient()
+    {
+        close();
+    }
+
+    QueryClient(const QueryClient&) = delete;
+    QueryClient& operator=(const QueryClient&) = delete;
+
+    bool connect(const std::string& path, std::string& error)
+    {
+        close();
+
+        sockaddr_un addr;
+        if(!wire::address(path, addr, error))
+            return false;
+
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd < 0 || ::connect(fd, (const sockaddr*)(&addr), sizeof(addr)) != 0)
+        {
+            error = "cannot connect to " + path;
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if(fd >= 0)
+            ::close(fd);
+        fd = -1;
+    }
+
+    // Sends lines as queries firstId, firstId + 1...
+    bool send(const std::vector<line>& lines, uint32_t firstId)
+    {
+        std::vector<wire::Query> frame;
+        frame.reserve(lines.size());
+        for(size_t i = 0; i < lines.size(); i++)
+            frame.push_back(wire::Query{ firstId + (uint32_t)(i), lines[i].slope, lines[i].offset });
+
+        return wire::writeFrame(fd, frame);
+    }
+
+    // Waits for the next reply frame
+    bool receive(std::vector<wire::Reply>& replies)
+    {
+        return wire::readFrame(fd, replies);
+    }
+
+private:
+
+    int fd;
+};
+
+#endif // IRM_SERVER
+
+#endif // QUERY_SERVER_HPP
@@ -0,0 +1,133 @@
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+
+#include <IRM.hpp>
+
+#ifndef SPATIAL_JOIN_HPP
+#define SPATIAL_JOIN_HPP
+
+// Sign of the turn a -> b -> c: 1 counterclockwise, -1 clockwise, 0 collinear.
+// Evaluated in double, which is exact for float coordinates of similar
+// magnitude: their differences and products all fit.
+template <class T>
+static inline int orientation(const basic_vec2<T>& a, const basic_vec2<T>& b, const basic_vec2<T>& c)
+{
+    double d = ((double)(b.x) - (double)(a.x)) * ((double)(c.y) - (double)(a.y)) - ((double)(b.y) - (double)(a.y)) * ((double)(c.x) - (double)(a.x));
+    return d > 0.0 ? 1 : (d < 0.0 ? -1 : 0);
+}
+
+// Whether c lies within the bounding box of a and b
+template <class T>
+static inline bool within(const basic_vec2<T>& a, const basic_vec2<T>& b, const basic_vec2<T>& c)
+{
+    return std::min(a.x, b.x) <= c.x && c.x <= std::max(a.x, b.x) && std::min(a.y, b.y) <= c.y && c.y <= std::max(a.y, b.y);
+}
+
+// Whether two closed segments share a point, touching included
+template <class T, class P, class Q>
+static inline bool segmentsIntersect(const basic_segment<T, P>& s, const basic_segment<T, Q>& t)
+{
+    int o1 = orientation(s.a, s.b, t.a), o2 = orientation(s.a, s.b, t.b);
+    int o3 = orientation(t.a, t.b, s.a), o4 = orientation(t.a, t.b, s.b);
+
+    if(o1 * o2 < 0 && o3 * o4 < 0)
+        return true;
+
+    // Touching or collinear: an end point lies on the other segment
+    return (o1 == 0 && within(s.a, s.b, t.a)) || (o2 == 0 && within(s.a, s.b, t.b)) ||
+           (o3 == 0 && within(t.a, t.b, s.a)) || (o4 == 0 && within(t.a, t.b, s.b));
+}
+
+// Probes a join thread takes at a time
+static const size_t JOIN_CHUNK = 256;
+
+// Reports every pair of a probe and an indexed segment of irm that
+// intersect, as f(probe index, indexed segment); irm.handleOf maps the
+// segment back to its handle. Each probe stabs the bucket of its own line,
+// in the (angle, distance) form so vertical probes work too, and the
+// candidates are confirmed with segmentsIntersect. Probes are sorted by
+// bucket and distance and handed to the threads in runs of JOIN_CHUNK, so
+// consecutive stabs mostly walk the same tree paths. f is called
+// concurrently from all threads, and irm must not change meanwhile.
+template <class Scalar, class Payload, unsigned int K, class ProbePayload, class BinaryFunction>
+void spatialJoin(BasicIRM<Scalar, Payload, K>& irm, const std::vector<basic_segment<Scalar, ProbePayload>>& probes, BinaryFunction f, unsigned int threads = 1)
+{
+    typedef BasicIRM<Scalar, Payload, K> index_type;
+
+    struct Probe
+    {
+        unsigned int bucket;
+        Scalar angle, distance;
+        size_t index;
+    };
+
+    // The line through a and b is every p with rotate(p, angle).x equal to
+    // that of a, for the angle rotating b - a onto the y axis
+    std::vector<Probe> order(probes.size());
+    for(size_t i = 0; i < probes.size(); i++)
+    {
+        const basic_segment<Scalar, ProbePayload>& s = probes[i];
+
+        Scalar angle = std::atan2(s.b.x - s.a.x, s.b.y - s.a.y);
+        if(angle < 0)
+            angle += scalar_traits<Scalar>::pi();
+        angle = std::min(std::max(angle, (Scalar)(0)), scalar_traits<Scalar>::pi());
+
+        Probe p = { irm.bucket(angle), angle, rotate(s.a, std::sin(angle), std::cos(angle)).x, i };
+        order[i] = p;
+    }
+
+    std::sort(order.begin(), order.end(), [](const Probe& a, const Probe& b)
+    {
+        return a.bucket != b.bucket ? a.bucket < b.bucket : a.distance < b.distance;
+    });
+
+    std::atomic<size_t> next(0);
+
+    auto work = [&]()
+    {
+        for(;;)
+        {
+            const size_t first = next.fetch_add(JOIN_CHUNK);
+            if(first >= order.size())
+                return;
+
+            const size_t last = std::min(first + JOIN_CHUNK, order.size());
+            for(size_t u = first; u < last; u++)
+            {
+                const Probe& p = order[u];
+                const basic_segment<Scalar, ProbePayload>& s = probes[p.index];
+                const Scalar minx = std::min(s.a.x, s.b.x), maxx = std::max(s.a.x, s.b.x);
+                const Scalar miny = std::min(s.a.y, s.b.y), maxy = std::max(s.a.y, s.b.y);
+
+                irm.visitCandidates(p.angle, p.distance, [&](const typename index_type::segment_type& g)
+                {
+                    // Most candidates cross the probe's line far from the
+                    // probe, which their boxes already tell
+                    if(std::max(g.a.x, g.b.x) < minx || std::min(g.a.x, g.b.x) > maxx || std::max(g.a.y, g.b.y) < miny || std::min(g.a.y, g.b.y) > maxy)
+                        return;
+
+                    if(segmentsIntersect(s, g))
+                    {
+                        IRM_COUNT(hits, 1);
+                        f(p.index, g);
+                    }
+                });
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(unsigned int t = 1; t < threads; t++)
+        pool.push_back(std::thread(work));
+
+    work();
+
+    for(std::thread& t : pool)
+        t.join();
+}
+
+#endif // SPATIAL_JOIN_HPP
@@ -14,40 +14,42 @@ static inline float rand(float min, float max)
     return min + ((float)(std::rand()) / (float)(RAND_MAX)) * (max - min);
 }
 
+// Monotonic nanoseconds, only meaningful as a difference
 static inline unsigned long int now()
 {
-    return (unsigned long int)(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    return (unsigned long int)(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
 }
 
-static std::vector<segment> randomSegments(unsigned int num, float bound, float length = 10.0F)
+static inline unsigned int randomSeed()
 {
-    std::mt19937 gen(std::time(NULL));
-    std::uniform_real_distribution<float> rd(-bound, bound);
+    return (unsigned int)(std::time(NULL));
+}
 
-    std::mt19937 gen_length(std::time(NULL));
+static inline std::vector<segment> randomSegments(unsigned int num, float bound, float length = 10.0F, unsigned int seed = randomSeed())
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> rd(-bound, bound);
     std::uniform_real_distribution<float> rd_length(EPSILON, length);
 
     std::vector<segment> res;
     for(unsigned int i = 0U; i < num; i++)
     {
         vec2 aa = vec2(rd(gen), rd(gen));
-        vec2 bb = vec2(aa.x + rd_length(gen_length), aa.y + rd_length(gen_length));
+        vec2 bb = vec2(aa.x + rd_length(gen), aa.y + rd_length(gen));
         res.push_back(segment(aa, bb));
     }
     return res;
 }
 
-static std::vector<line> randomLines(unsigned int num, float bound)
+static inline std::vector<line> randomLines(unsigned int num, float bound, unsigned int seed = randomSeed())
 {
-    std::mt19937 gen(std::time(NULL));
+    std::mt19937 gen(seed);
     std::uniform_real_distribution<float> rd(-PI / 2.0F, PI / 2.0F);
-
-    std::mt19937 gen_bound(std::time(NULL));
     std::uniform_real_distribution<float> rd_bound(-bound, bound);
 
     std::vector<line> res;
     for(unsigned int i = 0U; i < num; i++)
-        res.push_back(line(std::tan(rd(gen)), rd_bound(gen_bound)));
+        res.push_back(line(std::tan(rd(gen)), rd_bound(gen)));
     return res;
 }
 
@@ -0,0 +1,335 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <algorithm>
+
+#include <Geometry.hpp>
+#include <Utility.hpp>
+
+#ifndef WORKLOAD_HPP
+#define WORKLOAD_HPP
+
+// Scene and query generators closer to real maps than randomSegments and
+// randomLines, plus a loader for segment files. Every generator is driven by
+// an explicit seed so workloads can be reproduced.
+
+static const char* const SEGMENT_WORKLOADS[] = { "uniform", "clustered", "powerlaw", "axis", "long", "buildings", "roads" };
+static const char* const LINE_WORKLOADS[] = { "uniform", "axis", "narrow", "hotspot" };
+
+static inline vec2 polar(const vec2& p, float angle, float length)
+{
+    return vec2(p.x + std::cos(angle) * length, p.y + std::sin(angle) * length);
+}
+
+// Segments around a few Gaussian clusters, like the blocks of a city
+static inline std::vector<segment> clusteredSegments(unsigned int num, float bound, float length, unsigned int seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> rd(-bound, bound);
+    std::uniform_real_distribution<float> rd_angle(0.0F, 2.0F * PI);
+    std::uniform_real_distribution<float> rd_length(EPSILON, length);
+    std::normal_distribution<float> rd_spread(0.0F, bound / 20.0F);
+
+    std::vector<vec2> centers;
+    for(unsigned int i = 0U; i < std::max(1U, num / 1000U); i++)
+        centers.push_back(vec2(rd(gen), rd(gen)));
+
+    std::uniform_int_distribution<size_t> rd_center(0, centers.size() - 1);
+
+    std::vector<segment> res;
+    for(unsigned int i = 0U; i < num; i++)
+    {
+        const vec2& c = centers[rd_center(gen)];
+        vec2 aa = vec2(c.x + rd_spread(gen), c.y + rd_spread(gen));
+        res.push_back(segment(aa, polar(aa, rd_angle(gen), rd_length(gen))));
+    }
+    return res;
+}
+
+// Uniformly placed segments with Pareto distributed lengths: mostly short,
+// with a heavy tail of segments up to the size of the scene
+static inline std::vector<segment> powerLawSegments(unsigned int num, float bound, float length, unsigned int seed, float alpha = 1.5F)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> rd(-bound, bound);
+    std::uniform_real_distribution<float> rd_angle(0.0F, 2.0F * PI);
+    std::uniform_real_distribution<float> rd_unit(EPSILON, 1.0F);
+
+    const float minimum = std::max(EPSILON, length / 10.0F);
+
+    std::vector<segment> res;
+    for(unsigned int i = 0U; i < num; i++)
+    {
+        vec2 aa = vec2(rd(gen), rd(gen));
+        float l = std::min(minimum / std::pow(rd_unit(gen), 1.0F / alpha), 2.0F * bound);
+        res.push_back(segment(aa, polar(aa, rd_angle(gen), l)));
+    }
+    return res;
+}
+
+// Horizontal and vertical walls snapped to a lattice of spacing length
+static inline std::vector<segment> axisAlignedSegments(unsigned int num, float bound, float length, unsigned int seed)
+{
+    std::mt19937 gen(seed);
+    const int cells = std::max(1, (int)(bound / std::max(length, EPSILON)));
+    std::uniform_int_distribution<int> rd(-cells, cells - 1);
+    std::bernoulli_distribution rd_axis(0.5);
+
+    const float step = bound / (float)(cells);
+
+    std::vector<segment> res;
+    for(unsigned int i = 0U; i < num; i++)
+    {
+        vec2 aa = vec2((float)(rd(gen)) * step, (float)(rd(gen)) * step);
+        vec2 bb = rd_axis(gen) ? vec2(aa.x + step, aa.y) : vec2(aa.x, aa.y + step);
+        res.push_back(segment(aa, bb));
+    }
+    return res;
+}
+
+// Long walls spanning a quarter to all of the scene
+static inline std::vector<segment> longSegments(unsigned int num, float bound, unsigned int seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> rd(-bound, bound);
+    std::uniform_real_distribution<float> rd_angle(0.0F, 2.0F * PI);
+    std::uniform_real_distribution<float> rd_length(bound / 4.0F, bound);
+
+    std::vector<segment> res;
+    for(unsigned int i = 0U; i < num; i++)
+    {
+        vec2 aa = vec2(rd(gen), rd(gen));
+        res.push_back(segment(aa, polar(aa, rd_angle(gen), rd_length(gen))));
+    }
+    return res;
+}
+
+// Building outlines: rotated rectangles up to length across, each emitted
+// as four consecutive segments going around it
+static inline std::vector<segment> buildingSegments(unsigned int num, float bound, float length, unsigned int seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> rd(-bound, bound);
+    std::uniform_real_distribution<float> rd_angle(0.0F, PI / 2.0F);
+    std::uniform_real_distribution<float> rd_side(std::max(EPSILON, length / 4.0F), std::max(EPSILON, length));
+
+    std::vector<segment> res;
+    while(res.size() < num)
+    {
+        float a = rd_angle(gen);
+        vec2 p0 = vec2(rd(gen), rd(gen));
+        vec2 p1 = polar(p0, a, rd_side(gen));
+        float h = rd_side(gen);
+        vec2 p2 = polar(p1, a + PI / 2.0F, h);
+        vec2 p3 = polar(p0, a + PI / 2.0F, h);
+
+        res.push_back(segment(p0, p1));
+        res.push_back(segment(p1, p2));
+        res.push_back(segment(p2, p3));
+        res.push_back(segment(p3, p0));
+    }
+
+    res.erase(res.begin() + num, res.end());
+    return res;
+}
+
+// Roads: random walks of 8 to 64 steps of up to length each, turning by at
+// most 30 degrees per step, emitted as consecutive segments
+static inline std::vector<segment> roadSegments(unsigned int num, float bound, float length, unsigned int seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> rd(-bound, bound);
+    std::uniform_real_distribution<float> rd_angle(0.0F, 2.0F * PI);
+    std::uniform_real_distribution<float> rd_turn(-PI / 6.0F, PI / 6.0F);
+    std::uniform_real_distribution<float> rd_length(EPSILON, std::max(EPSILON, length));
+    std::uniform_int_distribution<unsigned int> rd_steps(8, 64);
+
+    std::vector<segment> res;
+    while(res.size() < num)
+    {
+        vec2 p = vec2(rd(gen), rd(gen));
+        float a = rd_angle(gen);
+
+        for(unsigned int i = rd_steps(gen); i > 0 && res.size() < num; i--)
+        {
+            vec2 q = polar(p, a, rd_length(gen));
+            res.push_back(segment(p, q));
+            p = q;
+            a += rd_turn(gen);
+        }
+    }
+
+    return res;
+}
+
+static inline line lineThrough(const vec2& p, float angle)
+{
+    float slope = std::tan(angle);
+    return line(slope, p.y - slope * p.x);
+}
+
+// Angles clustered around the axes, as along the streets of a grid city
+static inline std::vector<line> axisLines(unsigned int num, float bound, unsigned int seed, float spread = 0.05F)
+{
+    std::mt19937 gen(seed);
+    std::normal_distribution<float> rd_angle(0.0F, spread);
+    std::bernoulli_distribution rd_axis(0.5);
+    std::uniform_real_distribution<float> rd(-bound, bound);
+
+    std::vector<line> res;
+    for(unsigned int i = 0U; i < num; i++)
+    {
+        float a = rd_angle(gen) + (rd_axis(gen) ? 0.0F : PI / 2.0F);
+        res.push_back(lineThrough(vec2(rd(gen), rd(gen)), a));
+    }
+    return res;
+}
+
+// All angles within a narrow band around one direction, so most queries
+// land in the same few buckets
+static inline std::vector<line> narrowLines(unsigned int num, float bound, unsigned int seed, float width = 0.1F)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> rd_center(-PI / 2.0F + width, PI / 2.0F - width);
+    std::uniform_real_distribution<float> rd(-bound, bound);
+
+    const float center = rd_center(gen);
+    std::uniform_real_distribution<float> rd_angle(center - width / 2.0F, center + width / 2.0F);
+
+    std::vector<line> res;
+    for(unsigned int i = 0U; i < num; i++)
+        res.push_back(lineThrough(vec2(rd(gen), rd(gen)), rd_angle(gen)));
+    return res;
+}
+
+// Lines through a handful of hotspots, with uniform angles
+static inline std::vector<line> hotspotLines(unsigned int num, float bound, unsigned int seed, unsigned int spots = 4U)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<float> rd(-bound, bound);
+    std::uniform_real_distribution<float> rd_angle(-PI / 2.0F, PI / 2.0F);
+    std::normal_distribution<float> rd_spread(0.0F, bound / 50.0F);
+
+    std::vector<vec2> centers;
+    for(unsigned int i = 0U; i < std::max(1U, spots); i++)
+        centers.push_back(vec2(rd(gen), rd(gen)));
+
+    std::uniform_int_distribution<size_t> rd_center(0, centers.size() - 1);
+
+    std::vector<line> res;
+    for(unsigned int i = 0U; i < num; i++)
+    {
+        const vec2& c = centers[rd_center(gen)];
+        res.push_back(lineThrough(vec2(c.x + rd_spread(gen), c.y + rd_spread(gen)), rd_angle(gen)));
+    }
+    return res;
+}
+
+static inline bool isSegmentWorkload(const std::string& kind)
+{
+    return std::find(std::begin(SEGMENT_WORKLOADS), std::end(SEGMENT_WORKLOADS), kind) != std::end(SEGMENT_WORKLOADS);
+}
+
+static inline bool isLineWorkload(const std::string& kind)
+{
+    return std::find(std::begin(LINE_WORKLOADS), std::end(LINE_WORKLOADS), kind) != std::end(LINE_WORKLOADS);
+}
+
+// Dispatches on one of SEGMENT_WORKLOADS, uniform for anything else
+static inline std::vector<segment> generateSegments(const std::string& kind, unsigned int num, float bound, float length, unsigned int seed)
+{
+    if(kind == "clustered")
+        return clusteredSegments(num, bound, length, seed);
+    if(kind == "powerlaw")
+        return powerLawSegments(num, bound, length, seed);
+    if(kind == "axis")
+        return axisAlignedSegments(num, bound, length, seed);
+    if(kind == "long")
+        return longSegments(num, bound, seed);
+    if(kind == "buildings")
+        return buildingSegments(num, bound, length, seed);
+    if(kind == "roads")
+        return roadSegments(num, bound, length, seed);
+
+    return randomSegments(num, bound, length, seed);
+}
+
+// Dispatches on one of LINE_WORKLOADS, uniform for anything else
+static inline std::vector<line> generateLines(const std::string& kind, unsigned int num, float bound, unsigned int seed)
+{
+    if(kind == "axis")
+        return axisLines(num, bound, seed);
+    if(kind == "narrow")
+        return narrowLines(num, bound, seed);
+    if(kind == "hotspot")
+        return hotspotLines(num, bound, seed);
+
+    return randomLines(num, bound, seed);
+}
+
+// Reads a segment file: one "ax ay bx by" segment per line, separated by
+// spaces, tabs or commas. Blank lines and lines starting with # are skipped.
+// On failure error describes the first problem and out is left unchanged.
+static inline bool loadSegments(const std::string& path, std::vector<segment>& out, std::string& error)
+{
+    std::ifstream in(path.c_str());
+    if(!in)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+
+    std::vector<segment> res;
+    std::string text;
+
+    for(unsigned int n = 1U; std::getline(in, text); n++)
+    {
+        std::replace(text.begin(), text.end(), ',', ' ');
+
+        std::istringstream fields(text);
+        std::string first;
+        if(!(fields >> first) || first[0] == '#')
+            continue;
+
+        fields.clear();
+        fields.seekg(0);
+
+        float ax, ay, bx, by;
+        std::string rest;
+        if(!(fields >> ax >> ay >> bx >> by) || (fields >> rest))
+        {
+            error = path + ":" + std::to_string(n) + ": expected four coordinates";
+            return false;
+        }
+
+        res.push_back(segment(vec2(ax, ay), vec2(bx, by)));
+    }
+
+    out.swap(res);
+    return true;
+}
+
+// Writes segments in the format read by loadSegments
+static inline bool saveSegments(const std::string& path, const std::vector<segment>& segs)
+{
+    std::ofstream o(path.c_str());
+    o.precision(9);
+
+    for(const segment& s : segs)
+        o << s.a.x << ' ' << s.a.y << ' ' << s.b.x << ' ' << s.b.y << '\n';
+
+    return (bool)(o);
+}
+
+// Half extent of the square centered on the origin holding every segment
+static inline float extentOf(const std::vector<segment>& segs)
+{
+    float res = 0.0F;
+    for(const segment& s : segs)
+        res = std::max(res, std::max(std::max(std::fabs(s.a.x), std::fabs(s.a.y)), std::max(std::fabs(s.b.x), std::fabs(s.b.y))));
+    return res;
+}
+
+#endif // WORKLOAD_HPP
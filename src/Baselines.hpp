@@ -0,0 +1,769 @@
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+
+#include "Benchmark.hpp"
+
+#ifndef BASELINES_HPP
+#define BASELINES_HPP
+
+// Competing spatial indexes for the benchmark. They share the interface of
+// NaiveIndex and IRMIndex (build from segments, bytes, querySize, insert and
+// remove by position), and all of them keep the caller's positions stable
+// the same way IRM does: an order list maps positions to internal ids.
+
+struct Box
+{
+    Box() : minx(INF), miny(INF), maxx(-INF), maxy(-INF) {}
+
+    float minx, miny, maxx, maxy;
+
+    static Box of(const segment& s)
+    {
+        Box b;
+        b.minx = std::min(s.a.x, s.b.x);
+        b.miny = std::min(s.a.y, s.b.y);
+        b.maxx = std::max(s.a.x, s.b.x);
+        b.maxy = std::max(s.a.y, s.b.y);
+        return b;
+    }
+
+    bool empty() const
+    {
+        return minx > maxx;
+    }
+
+    void expand(const Box& b)
+    {
+        minx = std::min(minx, b.minx);
+        miny = std::min(miny, b.miny);
+        maxx = std::max(maxx, b.maxx);
+        maxy = std::max(maxy, b.maxy);
+    }
+
+    float area() const
+    {
+        return empty() ? 0.0F : (maxx - minx) * (maxy - miny);
+    }
+
+    float enlargement(const Box& b) const
+    {
+        Box u = *this;
+        u.expand(b);
+        return u.area() - area();
+    }
+
+    float cx() const
+    {
+        return (minx + maxx) * 0.5F;
+    }
+
+    float cy() const
+    {
+        return (miny + maxy) * 0.5F;
+    }
+
+    // The line crosses the box when its corners aren't all on one side
+    bool crosses(const line& l) const
+    {
+        if(empty())
+            return false;
+
+        float a = l.slope * minx + l.offset, b = l.slope * maxx + l.offset;
+        float lo = std::min(a, b), hi = std::max(a, b);
+        return lo <= maxy && miny <= hi;
+    }
+};
+
+// Uniform grid of about one cell per segment, traversed along the line with
+// a 2D DDA. Each segment is listed in every cell its bounding box overlaps,
+// and a hit is only counted in the cell holding the intersection point, so
+// queries need no per-segment mailbox and can run concurrently.
+class GridIndex
+{
+public:
+
+    GridIndex(const Options&, const std::vector<segment>& segs) : segments(segs)
+    {
+        for(unsigned int i = 0; i < segments.size(); i++)
+        {
+            order.push_back(i);
+            bounds.expand(Box::of(segments[i]));
+        }
+
+        if(bounds.empty())
+        {
+            bounds.minx = bounds.miny = 0.0F;
+            bounds.maxx = bounds.maxy = 1.0F;
+        }
+
+        res = std::max(1U, (unsigned int)(std::sqrt((double)(segments.size()))));
+        cw = std::max((bounds.maxx - bounds.minx) / (float)(res), EPSILON);
+        ch = std::max((bounds.maxy - bounds.miny) / (float)(res), EPSILON);
+        cells.resize(res * res);
+
+        for(unsigned int i = 0; i < segments.size(); i++)
+            place(i, true);
+    }
+
+    size_t bytes() const
+    {
+        size_t res = sizeof(segment) * segments.capacity() + sizeof(unsigned int) * (order.capacity() + outside.capacity()) +
+                     sizeof(std::vector<unsigned int>) * cells.capacity();
+        for(const auto& c : cells)
+            res += sizeof(unsigned int) * c.capacity();
+        return res;
+    }
+
+    size_t querySize(const line& l) const
+    {
+        // Clip the line to the grid (Liang-Barsky), parameterized by length
+        double th = std::atan((double)(l.slope));
+        double dx = std::cos(th), dy = std::sin(th), ox = 0.0, oy = (double)(l.offset);
+        double t0 = -std::numeric_limits<double>::infinity(), t1 = std::numeric_limits<double>::infinity();
+
+        const double p[4] = { -dx, dx, -dy, dy };
+        const double q[4] = { ox - bounds.minx, bounds.maxx - ox, oy - bounds.miny, bounds.maxy - oy };
+
+        for(int i = 0; i < 4; i++)
+        {
+            if(p[i] == 0.0)
+            {
+                if(q[i] < 0.0)
+                    return outsideSize(l);
+                continue;
+            }
+
+            double t = q[i] / p[i];
+            if(p[i] < 0.0)
+                t0 = std::max(t0, t);
+            else
+                t1 = std::min(t1, t);
+        }
+
+        if(t0 > t1)
+            return outsideSize(l);
+
+        double sx = ox + dx * t0, sy = oy + dy * t0;
+        unsigned int ix = cellX((float)(sx)), iy = cellY((float)(sy));
+        unsigned int ex = cellX((float)(ox + dx * t1)), ey = cellY((float)(oy + dy * t1));
+
+        int stepx = dx > 0.0 ? 1 : -1, stepy = dy > 0.0 ? 1 : -1;
+        double inf = std::numeric_limits<double>::infinity();
+        double tmx = dx != 0.0 ? ((bounds.minx + (double)(ix + (stepx > 0 ? 1 : 0)) * cw) - sx) / dx : inf;
+        double tmy = dy != 0.0 ? ((bounds.miny + (double)(iy + (stepy > 0 ? 1 : 0)) * ch) - sy) / dy : inf;
+        double tdx = dx != 0.0 ? cw / std::fabs(dx) : inf;
+        double tdy = dy != 0.0 ? ch / std::fabs(dy) : inf;
+
+        size_t hits = outsideSize(l);
+        vec2 pt;
+
+        for(unsigned int steps = 0; steps <= 2 * res + 2; steps++)
+        {
+            for(unsigned int id : cells[iy * res + ix])
+                if(l.intersect(segments[id], pt) && cellX(pt.x) == ix && cellY(pt.y) == iy)
+                    hits++;
+
+            if(ix == ex && iy == ey)
+                break;
+
+            if(tmx < tmy)
+            {
+                if((stepx < 0 && ix == 0) || (stepx > 0 && ix + 1 == res))
+                    break;
+                ix += stepx;
+                tmx += tdx;
+            }
+            else
+            {
+                if((stepy < 0 && iy == 0) || (stepy > 0 && iy + 1 == res))
+                    break;
+                iy += stepy;
+                tmy += tdy;
+            }
+        }
+
+        return hits;
+    }
+
+    // Segments reaching outside the initial bounds are kept in a list that
+    // every query scans, since the traversal is clipped to the bounds
+    void insert(const std::vector<segment>& segs)
+    {
+        for(const segment& s : segs)
+        {
+            unsigned int id = (unsigned int)(segments.size());
+            order.push_back(id);
+            segments.push_back(s);
+
+            if(inside(id))
+                place(id, true);
+            else
+                outside.push_back(id);
+        }
+    }
+
+    void remove(size_t from)
+    {
+        unsigned int id = order[from];
+        order.erase(order.begin() + from);
+
+        if(inside(id))
+            place(id, false);
+        else
+            outside.erase(std::find(outside.begin(), outside.end(), id));
+    }
+
+private:
+
+    bool inside(unsigned int id) const
+    {
+        Box b = Box::of(segments[id]);
+        return bounds.minx <= b.minx && b.maxx <= bounds.maxx && bounds.miny <= b.miny && b.maxy <= bounds.maxy;
+    }
+
+    size_t outsideSize(const line& l) const
+    {
+        size_t hits = 0;
+        vec2 pt;
+        for(unsigned int id : outside)
+            hits += l.intersect(segments[id], pt) ? 1 : 0;
+        return hits;
+    }
+
+    unsigned int cellX(float x) const
+    {
+        float c = std::floor((x - bounds.minx) / cw);
+        return c <= 0.0F ? 0U : std::min((unsigned int)(c), res - 1);
+    }
+
+    unsigned int cellY(float y) const
+    {
+        float c = std::floor((y - bounds.miny) / ch);
+        return c <= 0.0F ? 0U : std::min((unsigned int)(c), res - 1);
+    }
+
+    void place(unsigned int id, bool add)
+    {
+        Box b = Box::of(segments[id]);
+
+        for(unsigned int y = cellY(b.miny); y <= cellY(b.maxy); y++)
+        {
+            for(unsigned int x = cellX(b.minx); x <= cellX(b.maxx); x++)
+            {
+                std::vector<unsigned int>& c = cells[y * res + x];
+                if(add)
+                    c.push_back(id);
+                else
+                    c.erase(std::find(c.begin(), c.end(), id));
+            }
+        }
+    }
+
+    std::vector<segment> segments;
+    std::vector<unsigned int> order, outside;
+    std::vector<std::vector<unsigned int>> cells;
+    Box bounds;
+    unsigned int res;
+    float cw, ch;
+};
+
+// Binary bounding volume hierarchy built top-down by median splits on the
+// longest axis. Inserts descend to the child that grows least and split
+// leaves that get too large; removals leave the boxes conservatively large.
+class BVHIndex
+{
+public:
+
+    BVHIndex(const Options&, const std::vector<segment>& segs) : segments(segs), leafOf(segs.size())
+    {
+        std::vector<unsigned int> ids;
+        for(unsigned int i = 0; i < segments.size(); i++)
+        {
+            order.push_back(i);
+            ids.push_back(i);
+        }
+
+        nodes.push_back(Node());
+        build(0, ids);
+    }
+
+    size_t bytes() const
+    {
+        size_t res = sizeof(segment) * segments.capacity() + sizeof(unsigned int) * (order.capacity() + leafOf.capacity()) + sizeof(Node) * nodes.capacity();
+        for(const Node& n : nodes)
+            res += sizeof(unsigned int) * n.items.capacity();
+        return res;
+    }
+
+    size_t querySize(const line& l) const
+    {
+        size_t hits = 0;
+        vec2 pt;
+
+        unsigned int stack[64];
+        unsigned int top = 0;
+        stack[top++] = 0;
+
+        while(top != 0)
+        {
+            const Node& n = nodes[stack[--top]];
+            if(!n.box.crosses(l))
+                continue;
+
+            if(n.leaf())
+            {
+                for(unsigned int id : n.items)
+                    hits += l.intersect(segments[id], pt) ? 1 : 0;
+            }
+            else
+            {
+                stack[top++] = n.left;
+                stack[top++] = n.right;
+            }
+        }
+
+        return hits;
+    }
+
+    void insert(const std::vector<segment>& segs)
+    {
+        for(const segment& s : segs)
+        {
+            unsigned int id = (unsigned int)(segments.size());
+            segments.push_back(s);
+            order.push_back(id);
+            leafOf.push_back(0);
+
+            Box b = Box::of(s);
+            unsigned int n = 0;
+            unsigned int depth = 0;
+
+            while(!nodes[n].leaf())
+            {
+                nodes[n].box.expand(b);
+                const Node& c = nodes[n];
+                n = nodes[c.left].box.enlargement(b) <= nodes[c.right].box.enlargement(b) ? c.left : c.right;
+                depth++;
+            }
+
+            nodes[n].box.expand(b);
+            nodes[n].items.push_back(id);
+            leafOf[id] = n;
+
+            // Keep the stack in querySize large enough
+            if(nodes[n].items.size() > 2 * LEAF && depth + 2 < 64)
+            {
+                std::vector<unsigned int> ids;
+                ids.swap(nodes[n].items);
+                build(n, ids);
+            }
+        }
+    }
+
+    void remove(size_t from)
+    {
+        unsigned int id = order[from];
+        order.erase(order.begin() + from);
+
+        std::vector<unsigned int>& items = nodes[leafOf[id]].items;
+        items.erase(std::find(items.begin(), items.end(), id));
+    }
+
+private:
+
+    static const unsigned int LEAF = 4;
+
+    struct Node
+    {
+        Node() : left(0), right(0) {}
+
+        Box box;
+        unsigned int left, right;
+        std::vector<unsigned int> items;
+
+        bool leaf() const
+        {
+            return left == 0;
+        }
+    };
+
+    void build(unsigned int n, std::vector<unsigned int>& ids)
+    {
+        Box b;
+        for(unsigned int id : ids)
+            b.expand(Box::of(segments[id]));
+        nodes[n].box = b;
+
+        if(ids.size() <= LEAF)
+        {
+            nodes[n].items = ids;
+            for(unsigned int id : ids)
+                leafOf[id] = n;
+            return;
+        }
+
+        bool xaxis = b.maxx - b.minx >= b.maxy - b.miny;
+        std::vector<unsigned int>::iterator mid = ids.begin() + ids.size() / 2;
+        std::nth_element(ids.begin(), mid, ids.end(), [&](unsigned int a, unsigned int c)
+        {
+            Box ba = Box::of(segments[a]), bc = Box::of(segments[c]);
+            return xaxis ? ba.cx() < bc.cx() : ba.cy() < bc.cy();
+        });
+
+        std::vector<unsigned int> lo(ids.begin(), mid), hi(mid, ids.end());
+
+        unsigned int l = (unsigned int)(nodes.size());
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        nodes[n].left = l;
+        nodes[n].right = l + 1;
+
+        build(l, lo);
+        build(l + 1, hi);
+    }
+
+    std::vector<segment> segments;
+    std::vector<unsigned int> order, leafOf;
+    std::vector<Node> nodes;
+};
+
+// R-tree with a fan-out of up to M entries, bulk loaded with Sort-Tile-
+// Recursive packing. Inserts use Guttman's least enlargement descent and
+// quadratic split; removals shrink the boxes on the path but don't reinsert
+// entries of underfull nodes.
+class RTreeIndex
+{
+public:
+
+    RTreeIndex(const Options&, const std::vector<segment>& segs) : segments(segs), leafOf(segs.size()), root(0)
+    {
+        std::vector<Entry> level;
+        for(unsigned int i = 0; i < segments.size(); i++)
+        {
+            order.push_back(i);
+            level.push_back(Entry(Box::of(segments[i]), i));
+        }
+
+        bool leaf = true;
+        do
+        {
+            level = pack(level, leaf);
+            leaf = false;
+        }
+        while(level.size() > 1);
+
+        root = level.empty() ? newNode(true) : level.front().ref;
+        nodes[root].parent = NONE;
+    }
+
+    size_t bytes() const
+    {
+        size_t res = sizeof(segment) * segments.capacity() + sizeof(unsigned int) * (order.capacity() + leafOf.capacity()) + sizeof(Node) * nodes.capacity();
+        for(const Node& n : nodes)
+            res += sizeof(Entry) * n.entries.capacity();
+        return res;
+    }
+
+    size_t querySize(const line& l) const
+    {
+        size_t hits = 0;
+        vec2 pt;
+
+        std::vector<unsigned int> stack(1, root);
+        while(!stack.empty())
+        {
+            const Node& n = nodes[stack.back()];
+            stack.pop_back();
+
+            for(const Entry& e : n.entries)
+            {
+                if(!e.box.crosses(l))
+                    continue;
+
+                if(n.leaf)
+                    hits += l.intersect(segments[e.ref], pt) ? 1 : 0;
+                else
+                    stack.push_back(e.ref);
+            }
+        }
+
+        return hits;
+    }
+
+    void insert(const std::vector<segment>& segs)
+    {
+        for(const segment& s : segs)
+        {
+            unsigned int id = (unsigned int)(segments.size());
+            segments.push_back(s);
+            order.push_back(id);
+            leafOf.push_back(0);
+
+            Entry e(Box::of(s), id);
+            unsigned int n = root;
+
+            while(!nodes[n].leaf)
+            {
+                unsigned int best = 0;
+                float grow = INF;
+                for(unsigned int i = 0; i < nodes[n].entries.size(); i++)
+                {
+                    float g = nodes[n].entries[i].box.enlargement(e.box);
+                    if(g < grow || (g == grow && nodes[n].entries[i].box.area() < nodes[n].entries[best].box.area()))
+                    {
+                        best = i;
+                        grow = g;
+                    }
+                }
+                n = nodes[n].entries[best].ref;
+            }
+
+            add(n, e);
+        }
+    }
+
+    void remove(size_t from)
+    {
+        unsigned int id = order[from];
+        order.erase(order.begin() + from);
+
+        unsigned int n = leafOf[id];
+        std::vector<Entry>& es = nodes[n].entries;
+        for(size_t i = 0; i < es.size(); i++)
+        {
+            if(es[i].ref == id)
+            {
+                es.erase(es.begin() + i);
+                break;
+            }
+        }
+
+        adjust(n);
+    }
+
+private:
+
+    static const unsigned int M = 16;
+    static const unsigned int NONE = ~0U;
+
+    struct Entry
+    {
+        Entry(const Box& box, unsigned int ref) : box(box), ref(ref) {}
+
+        Box box;
+        unsigned int ref;
+    };
+
+    struct Node
+    {
+        Node(bool leaf) : leaf(leaf), parent(NONE) {}
+
+        bool leaf;
+        unsigned int parent;
+        std::vector<Entry> entries;
+
+        Box box() const
+        {
+            Box b;
+            for(const Entry& e : entries)
+                b.expand(e.box);
+            return b;
+        }
+    };
+
+    unsigned int newNode(bool leaf)
+    {
+        nodes.push_back(Node(leaf));
+        return (unsigned int)(nodes.size() - 1);
+    }
+
+    // Attaches e to node n, fixing the back references of what it points to
+    void attach(unsigned int n, const Entry& e)
+    {
+        nodes[n].entries.push_back(e);
+        if(nodes[n].leaf)
+            leafOf[e.ref] = n;
+        else
+            nodes[e.ref].parent = n;
+    }
+
+    // Sort-Tile-Recursive: packs one level of entries into nodes of M
+    std::vector<Entry> pack(std::vector<Entry>& level, bool leaf)
+    {
+        size_t count = (level.size() + M - 1) / M;
+        size_t slices = std::max((size_t)(1), (size_t)(std::ceil(std::sqrt((double)(count)))));
+        size_t per = slices * M;
+
+        std::sort(level.begin(), level.end(), [](const Entry& a, const Entry& b) { return a.box.cx() < b.box.cx(); });
+
+        std::vector<Entry> up;
+        for(size_t s = 0; s < level.size(); s += per)
+        {
+            std::vector<Entry>::iterator first = level.begin() + s, last = level.begin() + std::min(s + per, level.size());
+            std::sort(first, last, [](const Entry& a, const Entry& b) { return a.box.cy() < b.box.cy(); });
+
+            for(std::vector<Entry>::iterator i = first; i < last; i += std::min((std::ptrdiff_t)(M), last - i))
+            {
+                unsigned int n = newNode(leaf);
+                for(std::vector<Entry>::iterator e = i; e < i + std::min((std::ptrdiff_t)(M), last - i); ++e)
+                    attach(n, *e);
+                up.push_back(Entry(nodes[n].box(), n));
+            }
+        }
+
+        return up;
+    }
+
+    void add(unsigned int n, const Entry& e)
+    {
+        attach(n, e);
+
+        if(nodes[n].entries.size() > M)
+            split(n);
+        else
+            adjust(n);
+    }
+
+    // Recomputes the boxes from n up to the root
+    void adjust(unsigned int n)
+    {
+        while(nodes[n].parent != NONE)
+        {
+            unsigned int p = nodes[n].parent;
+            for(Entry& e : nodes[p].entries)
+                if(e.ref == n)
+                    e.box = nodes[n].box();
+            n = p;
+        }
+    }
+
+    // Guttman's quadratic split of an overflowing node
+    void split(unsigned int n)
+    {
+        std::vector<Entry> es;
+        es.swap(nodes[n].entries);
+
+        size_t sa = 0, sb = 1;
+        float worst = -INF;
+        for(size_t i = 0; i < es.size(); i++)
+        {
+            for(size_t j = i + 1; j < es.size(); j++)
+            {
+                Box u = es[i].box;
+                u.expand(es[j].box);
+                float d = u.area() - es[i].box.area() - es[j].box.area();
+                if(d > worst)
+                {
+                    worst = d;
+                    sa = i;
+                    sb = j;
+                }
+            }
+        }
+
+        unsigned int m = newNode(nodes[n].leaf);
+        Box ba = es[sa].box, bb = es[sb].box;
+        attach(n, es[sa]);
+        attach(m, es[sb]);
+
+        const size_t least = M * 2 / 5;
+        for(size_t i = 0; i < es.size(); i++)
+        {
+            if(i == sa || i == sb)
+                continue;
+
+            size_t left = es.size() - i;
+            bool toA;
+            if(nodes[n].entries.size() + left <= least)
+                toA = true;
+            else if(nodes[m].entries.size() + left <= least)
+                toA = false;
+            else
+                toA = ba.enlargement(es[i].box) <= bb.enlargement(es[i].box);
+
+            if(toA)
+            {
+                attach(n, es[i]);
+                ba.expand(es[i].box);
+            }
+            else
+            {
+                attach(m, es[i]);
+                bb.expand(es[i].box);
+            }
+        }
+
+        if(nodes[n].parent == NONE)
+        {
+            unsigned int r = newNode(false);
+            nodes[r].parent = NONE;
+            attach(r, Entry(nodes[n].box(), n));
+            attach(r, Entry(nodes[m].box(), m));
+            root = r;
+            return;
+        }
+
+        unsigned int p = nodes[n].parent;
+        for(Entry& e : nodes[p].entries)
+            if(e.ref == n)
+                e.box = nodes[n].box();
+
+        add(p, Entry(nodes[m].box(), m));
+    }
+
+    std::vector<segment> segments;
+    std::vector<unsigned int> order, leafOf;
+    std::vector<Node> nodes;
+    unsigned int root;
+};
+
+// Spatial join by forward plane sweep (Brinkhoff, Kriegel and Seeger,
+// "Efficient Processing of Spatial Joins Using R-trees"): both sets are
+// sorted by the left edge of their boxes, and each box in turn, taken from
+// whichever set has the leftmost next one, is tested against the boxes of
+// the other set starting before its right edge. Pairs whose boxes also
+// overlap in y go to the exact test. Reports f(probe index, segment index).
+template <class BinaryFunction>
+void sweepJoin(const std::vector<segment>& probes, const std::vector<segment>& segments, BinaryFunction f)
+{
+    struct Item
+    {
+        Box box;
+        size_t index;
+    };
+
+    auto sorted = [](const std::vector<segment>& segs)
+    {
+        std::vector<Item> res(segs.size());
+        for(size_t i = 0; i < segs.size(); i++)
+            res[i] = Item{ Box::of(segs[i]), i };
+
+        std::sort(res.begin(), res.end(), [](const Item& a, const Item& b) { return a.box.minx < b.box.minx; });
+        return res;
+    };
+
+    const std::vector<Item> p = sorted(probes), s = sorted(segments);
+
+    size_t i = 0, j = 0;
+    while(i < p.size() && j < s.size())
+    {
+        if(p[i].box.minx <= s[j].box.minx)
+        {
+            const Item& a = p[i++];
+            for(size_t u = j; u < s.size() && s[u].box.minx <= a.box.maxx; u++)
+                if(s[u].box.miny <= a.box.maxy && a.box.miny <= s[u].box.maxy && segmentsIntersect(probes[a.index], segments[s[u].index]))
+                    f(a.index, s[u].index);
+        }
+        else
+        {
+            const Item& b = s[j++];
+            for(size_t u = i; u < p.size() && p[u].box.minx <= b.box.maxx; u++)
+                if(p[u].box.miny <= b.box.maxy && b.box.miny <= p[u].box.maxy && segmentsIntersect(probes[p[u].index], segments[b.index]))
+                    f(p[u].index, b.index);
+        }
+    }
+}
+
+#endif // BASELINES_HPP
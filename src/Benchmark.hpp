@@ -0,0 +1,841 @@
+#include <string>
+#include <vector>
+#include <ostream>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <stdexcept>
+#include <cstdlib>
+
+#include <IRM.hpp>
+#include <PolylineIRM.hpp>
+#include <PagedIRM.hpp>
+#include <CompressedIRM.hpp>
+#include <QueryServer.hpp>
+#include <SpatialJoin.hpp>
+#include <QueryCache.hpp>
+#include <Workload.hpp>
+
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#define BIL(v) (((double)(v)) / 1e9)
+
+// Command line parameters shared by all suites
+struct Options
+{
+    Options() : n(1000), k(100), length(10.0F), bound(500.0F), lines(1000), trials(10), warmup(100), threads(1), writers(0), inserts(0), removes(100),
+                seed(1), min(0.0), max(0.0), step(0.0), scene("uniform"), angles("uniform"), plan("tree"), filtered(false), hilbert(false), nearest(8), budget(0.25), error(0.05) {}
+
+    unsigned int n, k;
+    float length, bound;
+    unsigned int lines, trials, warmup, threads;
+
+    // Threads updating the index while the load suite queries it
+    unsigned int writers;
+
+    // Segments inserted per trial (0 inserts as many as the scene holds) and
+    // single segment removals per trial
+    unsigned int inserts, removes;
+    unsigned int seed;
+
+    // Values taken by the swept parameter of a suite, unset while step is 0
+    double min, max, step;
+
+    // Generators of Workload.hpp for the scene and the query lines. The
+    // "file" scene uses the first n segments of imported.
+    std::string scene, angles, file;
+    std::shared_ptr<const std::vector<segment>> imported;
+
+    // How IRM searches its buckets: tree, scan or auto
+    std::string plan;
+
+    // IRM confirms candidates with the filtered exact predicate
+    bool filtered;
+
+    // IRM stores its segments in Hilbert curve order
+    bool hilbert;
+
+    // Intersections kept by nearest-hit queries
+    unsigned int nearest;
+
+    // Memory budget of PagedIRM as a share of its bucket file
+    double budget;
+
+    // Error bound of approximate counts, as a share of the candidates
+    double error;
+
+    std::string json, countersCsv;
+
+    unsigned int insertCount() const
+    {
+        return inserts == 0 ? n : inserts;
+    }
+};
+
+// Latency histogram in the manner of HdrHistogram: values below 2^SUB are
+// counted exactly, every higher power of two is split into 2^SUB linear
+// sub-buckets, so any recorded value is known to within 1 / 2^SUB. Memory
+// is fixed and recording is O(1), so each thread can keep its own and the
+// histograms are merged afterwards.
+class Histogram
+{
+public:
+
+    static const unsigned int SUB = 7;
+
+    Histogram() : counts((64 - SUB + 1) << SUB, 0), total(0), sum(0.0), largest(0) {}
+
+    void record(unsigned long int v)
+    {
+        counts[index(v)]++;
+        total++;
+        sum += (double)(v);
+        largest = std::max(largest, v);
+    }
+
+    Histogram& operator+=(const Histogram& o)
+    {
+        for(size_t i = 0; i < counts.size(); i++)
+            counts[i] += o.counts[i];
+
+        total += o.total;
+        sum += o.sum;
+        largest = std::max(largest, o.largest);
+        return *this;
+    }
+
+    inline uint64_t count() const
+    {
+        return total;
+    }
+
+    inline double mean() const
+    {
+        return total == 0 ? 0.0 : sum / (double)(total);
+    }
+
+    inline unsigned long int max() const
+    {
+        return largest;
+    }
+
+    // Nearest rank percentile, as the middle of its sub-bucket
+    double percentile(double p) const
+    {
+        if(total == 0)
+            return 0.0;
+
+        uint64_t rank = std::max((uint64_t)(std::ceil(p * (double)(total))), (uint64_t)(1));
+        uint64_t seen = 0;
+
+        for(size_t i = 0; i < counts.size(); i++)
+        {
+            seen += counts[i];
+            if(seen >= rank)
+                return std::min(middle(i), (double)(largest));
+        }
+        return (double)(largest);
+    }
+
+private:
+
+    static size_t index(unsigned long int v)
+    {
+        if(v < (1UL << SUB))
+            return (size_t)(v);
+
+        unsigned int e = SUB;
+        while(e < 63 && (v >> (e + 1)) != 0)
+            e++;
+
+        return (size_t)(e - SUB + 1) << SUB | (size_t)((v >> (e - SUB)) - (1UL << SUB));
+    }
+
+    static double middle(size_t i)
+    {
+        if(i < (1U << SUB))
+            return (double)(i);
+
+        unsigned int e = (unsigned int)(i >> SUB) + SUB - 1;
+        double width = std::ldexp(1.0, (int)(e - SUB));
+        return std::ldexp(1.0, (int)(e)) + (double)(i & ((1U << SUB) - 1)) * width + width / 2.0;
+    }
+
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    double sum;
+    unsigned long int largest;
+};
+
+// Latency distribution of a set of samples, all in nanoseconds
+struct Summary
+{
+    Summary() : count(0), mean(0.0), median(0.0), p99(0.0), p999(0.0), max(0.0) {}
+
+    size_t count;
+    double mean, median, p99, p999, max;
+
+    static Summary of(const Histogram& h)
+    {
+        Summary s;
+        s.count = (size_t)(h.count());
+        s.mean = h.mean();
+        s.median = h.percentile(0.5);
+        s.p99 = h.percentile(0.99);
+        s.p999 = h.percentile(0.999);
+        s.max = (double)(h.max());
+        return s;
+    }
+
+    static Summary of(std::vector<unsigned long int> samples)
+    {
+        Summary s;
+        if(samples.empty())
+            return s;
+
+        std::sort(samples.begin(), samples.end());
+
+        double total = 0.0;
+        for(unsigned long int v : samples)
+            total += (double)(v);
+
+        s.count = samples.size();
+        s.mean = total / (double)(s.count);
+        s.median = (double)(percentile(samples, 0.5));
+        s.p99 = (double)(percentile(samples, 0.99));
+        s.p999 = (double)(percentile(samples, 0.999));
+        s.max = (double)(samples.back());
+        return s;
+    }
+
+    // Nearest rank percentile of sorted samples
+    static unsigned long int percentile(const std::vector<unsigned long int>& sorted, double p)
+    {
+        size_t rank = (size_t)(std::ceil(p * (double)(sorted.size())));
+        return sorted[rank == 0 ? 0 : rank - 1];
+    }
+};
+
+// Measurements of one method at one parameter setting, over all trials
+struct Record
+{
+    Record() : build(0.0), bytes(0.0), hits(0.0), throughput(0.0), insert(0.0), remove(0.0) {}
+
+    std::string suite, method;
+    std::vector<std::pair<std::string, double>> params;
+
+    // Seconds to build, bytes held after building and intersections per line
+    double build, bytes, hits;
+
+    // Per query latency and queries per second over the query phase
+    Summary query;
+    double throughput;
+
+    // Seconds per inserted segment and per removal
+    double insert, remove;
+
+    // Suite specific values
+    std::vector<std::pair<std::string, double>> extra;
+
+    std::vector<QueryCounters> counters;
+};
+
+// Minimal streaming JSON writer, callers are trusted to nest correctly
+class JsonWriter
+{
+public:
+
+    JsonWriter(std::ostream& o) : o(o), first(true)
+    {
+        o.precision(12);
+    }
+
+    void begin(char c)
+    {
+        comma();
+        o << c;
+        first = true;
+    }
+
+    void end(char c)
+    {
+        o << c;
+        first = false;
+    }
+
+    void key(const std::string& k)
+    {
+        comma();
+        string(k);
+        o << ':';
+        first = true;
+    }
+
+    void value(double v)
+    {
+        comma();
+        if(std::isfinite(v))
+            o << v;
+        else
+            o << "null";
+    }
+
+    void value(const std::string& v)
+    {
+        comma();
+        string(v);
+    }
+
+    template <class T>
+    void field(const std::string& k, const T& v)
+    {
+        key(k);
+        value(v);
+    }
+
+    // Splices in an already serialized value
+    void raw(const std::string& v)
+    {
+        comma();
+        o << v;
+    }
+
+private:
+
+    void comma()
+    {
+        if(!first)
+            o << ',';
+        first = false;
+    }
+
+    void string(const std::string& v)
+    {
+        o << '"';
+        for(char c : v)
+        {
+            if(c == '"' || c == '\\')
+                o << '\\';
+            o << c;
+        }
+        o << '"';
+    }
+
+    std::ostream& o;
+    bool first;
+};
+
+// Geometry of one trial, drawn from the trial's seed
+struct Scene
+{
+    Scene(const Options& o, unsigned int trial)
+    {
+        unsigned int s = o.seed + trial * 4U;
+
+        if(o.imported)
+        {
+            // Inserts are uniform, the file only provides one scene
+            segments.assign(o.imported->begin(), o.imported->begin() + std::min((size_t)(o.n), o.imported->size()));
+            inserts = randomSegments(o.insertCount(), o.bound, o.length, s + 1U);
+        }
+        else
+        {
+            segments = generateSegments(o.scene, o.n, o.bound, o.length, s);
+            inserts = generateSegments(o.scene, o.insertCount(), o.bound, o.length, s + 1U);
+        }
+
+        lines = generateLines(o.angles, o.lines, o.bound, s + 2U);
+        warmup = generateLines(o.angles, o.warmup, o.bound, s + 3U);
+    }
+
+    std::vector<segment> segments, inserts;
+    std::vector<line> lines, warmup;
+};
+
+// The "typical" approach: test every segment against the line
+class NaiveIndex
+{
+public:
+
+    NaiveIndex(const Options&, const std::vector<segment>& segs) : segments(segs) {}
+
+    size_t bytes() const
+    {
+        return sizeof(segment) * segments.capacity();
+    }
+
+    size_t querySize(const line& l) const
+    {
+        size_t res = 0;
+        vec2 tmp;
+        for(const segment& s : segments)
+            res += l.intersect(s, tmp) ? 1 : 0;
+        return res;
+    }
+
+    void insert(const std::vector<segment>& segs)
+    {
+        segments.insert(segments.end(), segs.begin(), segs.end());
+    }
+
+    void remove(size_t from)
+    {
+        segments.erase(segments.begin() + from);
+    }
+
+private:
+
+    std::vector<segment> segments;
+};
+
+// Map is IRM, or a FixedIRM whose K equals o.k
+template <class Map = IRM>
+class IRMIndex
+{
+public:
+
+    IRMIndex(const Options& o, const std::vector<segment>& segs) : irm(o.k, segs, 1024, o.hilbert ? Map::HILBERT : Map::INPUT)
+    {
+        irm.setPredicate(o.filtered ? Map::FILTERED : Map::FAST);
+        irm.setPlan(o.plan == "scan" ? Map::SCAN : (o.plan == "auto" ? Map::AUTO : Map::TREE));
+    }
+
+    size_t bytes() const
+    {
+        return irm.statistics().bytes();
+    }
+
+    size_t querySize(const line& l) const
+    {
+        return irm.querySize(l);
+    }
+
+    void insert(const std::vector<segment>& segs)
+    {
+        irm.insert(segs);
+    }
+
+    void remove(size_t from)
+    {
+        irm.remove(from);
+    }
+
+    const std::vector<QueryCounters>& counters() const
+    {
+        return irm.counters();
+    }
+
+private:
+
+    mutable Map irm;
+};
+
+// The o.nearest intersections closest to the foot of the perpendicular from
+// the origin to each line, from IRM::nearest or (Sorted) from sorting the
+// full IRM::query result
+template <bool Sorted>
+class NearestIndex
+{
+public:
+
+    NearestIndex(const Options& o, const std::vector<segment>& segs) : irm(o.k, segs), m(o.nearest) {}
+
+    size_t bytes() const
+    {
+        return irm.statistics().bytes();
+    }
+
+    size_t querySize(const line& l) const
+    {
+        if(!Sorted)
+            return irm.nearest(l, l.closest(), m).size();
+
+        const vec2 o = l.closest();
+        std::vector<std::pair<float, const segment*>> hits;
+        vec2 p;
+        for(const IRM::interval& i : irm.query(l))
+        {
+            l.intersect(*i.value, p);
+            hits.push_back(std::make_pair(std::sqrt(SQUARE(p.x - o.x) + SQUARE(p.y - o.y)), i.value));
+        }
+
+        std::sort(hits.begin(), hits.end());
+        return std::min(hits.size(), (size_t)(m));
+    }
+
+    void insert(const std::vector<segment>& segs)
+    {
+        irm.insert(segs);
+    }
+
+    void remove(size_t from)
+    {
+        irm.remove(from);
+    }
+
+private:
+
+    mutable IRM irm;
+    unsigned int m;
+};
+
+// Indexes the scene as polylines of consecutive connected segments. Hits
+// count crossing edges so they match the segment indexes, and removing a
+// segment removes its whole shape.
+class PolylineIndex
+{
+public:
+
+    PolylineIndex(const Options& o, const std::vector<segment>& segs) : irm(o.k, std::vector<polyline>())
+    {
+        insert(segs);
+    }
+
+    size_t bytes() const
+    {
+        return irm.statistics().bytes() + sizeof(size_t) * owner.capacity();
+    }
+
+    size_t querySize(const line& l) const
+    {
+        return irm.queryEdges(l);
+    }
+
+    void insert(const std::vector<segment>& segs)
+    {
+        std::vector<polyline> shapes = chainsOf(segs);
+        size_t id = irm.insert(shapes);
+
+        for(const polyline& p : shapes)
+            owner.insert(owner.end(), p.edges(), id++);
+    }
+
+    void remove(size_t from)
+    {
+        if(from >= owner.size())
+            return;
+
+        size_t id = owner[from];
+        irm.remove(id);
+        owner.erase(std::remove(owner.begin(), owner.end(), id), owner.end());
+    }
+
+    const std::vector<QueryCounters>& counters() const
+    {
+        return irm.counters();
+    }
+
+private:
+
+    mutable PolylineIRM irm;
+
+    // Shape of each segment, in insertion order
+    std::vector<size_t> owner;
+};
+
+// CompressedIRM is built once and read only, so inserts and removals do
+// nothing
+class CompressedIndex
+{
+public:
+
+    CompressedIndex(const Options& o, const std::vector<segment>& segs) : irm(o.k, segs) {}
+
+    size_t bytes() const
+    {
+        return irm.statistics().bytes();
+    }
+
+    size_t querySize(const line& l) const
+    {
+        return irm.querySize(l);
+    }
+
+    void insert(const std::vector<segment>&) {}
+
+    void remove(size_t) {}
+
+    const std::vector<QueryCounters>& counters() const
+    {
+        return irm.counters();
+    }
+
+private:
+
+    mutable CompressedIRM irm;
+};
+
+#ifdef IRM_PAGED
+// PagedIRM over a temporary file of the scene, allowed to map o.budget of
+// it. Building includes writing the file. The file is read only, so inserts
+// and removals do nothing.
+class PagedIndex
+{
+public:
+
+    PagedIndex(const Options& o, const std::vector<segment>& segs)
+    {
+        const char* dir = std::getenv("TMPDIR");
+        std::string tmp = std::string(dir ? dir : "/tmp") + "/irm-paged-XXXXXX";
+
+        std::vector<char> name(tmp.begin(), tmp.end());
+        name.push_back('\0');
+
+        int fd = ::mkstemp(name.data());
+        if(fd < 0)
+            throw std::runtime_error("cannot create a file in " + std::string(dir ? dir : "/tmp"));
+        ::close(fd);
+        path = name.data();
+
+        std::string error;
+        if(!PagedIRM::write(path, o.k, segs, error) || !irm.open(path, 0, error))
+        {
+            ::unlink(path.c_str());
+            throw std::runtime_error(error);
+        }
+
+        // The budget is relative to the file, which is only known now
+        irm.setBudget((size_t)(o.budget * (double)(irm.fileBytes())));
+    }
+
+    ~PagedIndex()
+    {
+        irm.close();
+        ::unlink(path.c_str());
+    }
+
+    // Bytes on disk, the resident share is bounded by the budget
+    size_t bytes() const
+    {
+        return irm.fileBytes();
+    }
+
+    size_t querySize(const line& l) const
+    {
+        return irm.querySize(l);
+    }
+
+    void insert(const std::vector<segment>&) {}
+
+    void remove(size_t) {}
+
+    const std::vector<QueryCounters>& counters() const
+    {
+        return irm.counters();
+    }
+
+private:
+
+    std::string path;
+    mutable PagedIRM irm;
+};
+#endif
+
+// Accumulates the trials of one record
+struct Trials
+{
+    Trials() : build(0), bytes(0), hits(0), warmHits(0), queryTime(0), insertTime(0), inserted(0), removeTime(0), removed(0) {}
+
+    unsigned long int build;
+    size_t bytes, hits;
+
+    // Only kept so the warm-up queries can't be optimized away
+    size_t warmHits;
+
+    std::vector<unsigned long int> latencies;
+    unsigned long int queryTime;
+    unsigned long int insertTime;
+    size_t inserted;
+    unsigned long int removeTime;
+    size_t removed;
+    std::vector<QueryCounters> counters;
+
+    template <class Index>
+    void addCounters(const Index&) {}
+
+    template <class Map>
+    void addCounters(const IRMIndex<Map>& index)
+    {
+        addCounters(index.counters());
+    }
+
+    void addCounters(const PolylineIndex& index)
+    {
+        addCounters(index.counters());
+    }
+
+    void addCounters(const CompressedIndex& index)
+    {
+        addCounters(index.counters());
+    }
+
+#ifdef IRM_PAGED
+    void addCounters(const PagedIndex& index)
+    {
+        addCounters(index.counters());
+    }
+#endif
+
+    void addCounters(const std::vector<QueryCounters>& c)
+    {
+        counters.resize(c.size());
+        for(size_t i = 0; i < c.size(); i++)
+            counters[i] += c[i];
+    }
+
+    Record finish(const std::string& suite, const std::string& method, unsigned int trials) const
+    {
+        Record r;
+        r.suite = suite;
+        r.method = method;
+        r.build = BIL(build) / (double)(trials);
+        r.bytes = (double)(bytes) / (double)(trials);
+        r.hits = latencies.empty() ? 0.0 : (double)(hits) / (double)(latencies.size());
+        r.query = Summary::of(latencies);
+        r.throughput = queryTime == 0 ? 0.0 : (double)(latencies.size()) / BIL(queryTime);
+        r.insert = inserted == 0 ? 0.0 : BIL(insertTime) / (double)(inserted);
+        r.remove = removed == 0 ? 0.0 : BIL(removeTime) / (double)(removed);
+        r.counters = counters;
+        return r;
+    }
+};
+
+// Runs f(begin, end, thread) over [0, count) split across threads
+template <class Function>
+void parallel(unsigned int threads, size_t count, Function f)
+{
+    if(threads <= 1)
+    {
+        f((size_t)(0), count, 0U);
+        return;
+    }
+
+    std::vector<std::thread> pool;
+    for(unsigned int t = 0; t < threads; t++)
+        pool.push_back(std::thread(f, count * t / threads, count * (t + 1) / threads, t));
+
+    for(std::thread& t : pool)
+        t.join();
+}
+
+// Times each line, with a warm-up pass, across o.threads threads
+template <class Index>
+void queryPhase(const Options& o, const Index& index, const Scene& scene, Trials& acc)
+{
+    size_t warm = 0;
+    for(const line& l : scene.warmup)
+        warm += index.querySize(l);
+
+    std::vector<unsigned long int> latencies(scene.lines.size());
+    std::vector<size_t> hits(std::max(o.threads, 1U), 0);
+
+    unsigned long int start = now();
+    parallel(o.threads, scene.lines.size(), [&](size_t begin, size_t end, unsigned int t)
+    {
+        size_t h = 0;
+        for(size_t i = begin; i < end; i++)
+        {
+            unsigned long int qs = now();
+            h += index.querySize(scene.lines[i]);
+            latencies[i] = now() - qs;
+        }
+        hits[t] = h;
+    });
+    acc.queryTime += now() - start;
+
+    acc.latencies.insert(acc.latencies.end(), latencies.begin(), latencies.end());
+    for(size_t h : hits)
+        acc.hits += h;
+
+    acc.warmHits += warm;
+}
+
+// Builds, measures, queries and updates Index on one trial scene
+template <class Index>
+void runTrial(const Options& o, const Scene& scene, Trials& acc)
+{
+    unsigned long int start = now();
+    Index index(o, scene.segments);
+    acc.build += now() - start;
+
+    acc.bytes += index.bytes();
+
+    queryPhase(o, index, scene, acc);
+    acc.addCounters(index);
+
+    start = now();
+    index.insert(scene.inserts);
+    acc.insertTime += now() - start;
+    acc.inserted += scene.inserts.size();
+
+    size_t removes = std::min((size_t)(o.removes), scene.segments.size());
+    start = now();
+    for(size_t i = 0; i < removes; i++)
+        index.remove(0);
+    acc.removeTime += now() - start;
+    acc.removed += removes;
+}
+
+template <class Index>
+Record measure(const Options& o, const std::string& suite, const std::string& method)
+{
+    Trials acc;
+    for(unsigned int t = 0; t < o.trials; t++)
+        runTrial<Index>(o, Scene(o, t), acc);
+
+    return acc.finish(suite, method, o.trials);
+}
+
+// Values of the swept parameter, the defaults unless --range was given
+static inline std::vector<double> sweep(const Options& o, double min, double max, double step)
+{
+    if(o.step > 0.0)
+    {
+        min = o.min;
+        max = o.max;
+        step = o.step;
+    }
+
+    std::vector<double> res;
+    for(unsigned int i = 0; min + step * (double)(i) <= max + step * 1e-9; i++)
+        res.push_back(min + step * (double)(i));
+    return res;
+}
+
+typedef void (*SuiteFunction)(const Options&, std::vector<Record>&);
+
+struct Suite
+{
+    const char* name;
+    const char* description;
+    SuiteFunction run;
+};
+
+// Defined in Suites.cpp
+void suiteK(const Options& o, std::vector<Record>& out);
+void suiteN(const Options& o, std::vector<Record>& out);
+void suiteLength(const Options& o, std::vector<Record>& out);
+void suiteBaselines(const Options& o, std::vector<Record>& out);
+void suiteFixed(const Options& o, std::vector<Record>& out);
+void suiteChains(const Options& o, std::vector<Record>& out);
+void suiteNearest(const Options& o, std::vector<Record>& out);
+void suiteCompressed(const Options& o, std::vector<Record>& out);
+void suiteLayout(const Options& o, std::vector<Record>& out);
+void suitePlan(const Options& o, std::vector<Record>& out);
+void suiteLoad(const Options& o, std::vector<Record>& out);
+void suiteJoin(const Options& o, std::vector<Record>& out);
+void suiteCache(const Options& o, std::vector<Record>& out);
+void suiteApprox(const Options& o, std::vector<Record>& out);
+#ifdef IRM_PAGED
+void suitePaged(const Options& o, std::vector<Record>& out);
+#endif
+#ifdef IRM_SERVER
+void suiteServer(const Options& o, std::vector<Record>& out);
+#endif
+
+#endif // BENCHMARK_HPP
@@ -1,512 +1,349 @@
 #include <fstream>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
 
-#include "IRM.hpp"
+#include "Benchmark.hpp"
 
-// #define TEST_VERIFY
-#define TEST_K
-#define TEST_GENERAL
-#define TEST_L
-// #define TEST_DEBUG
-
-#define BIL(v) (((double)(v)) / 1e9)
-#define MIL(v) (((double)(v)) / 1e6)
-#define RATE(n, d) (((double)(n)) / ((double)(d)))
-#define RATEB(n, d) (((double)(n)) / BIL(d))
-
-#ifdef TEST_VERIFY
-
-static bool test()
+static const Suite SUITES[] =
 {
-    line l = randomLines(1, 100.0F)[0];
-    l.slope = 1.5F;
-    l.offset = 3.0F;
-
-    segment s = randomSegments(1, 100.0F)[0];
-    s.a = vec2(5.0F, 10.0F);
-    s.b = vec2(10.0F, 10.0F);
-
-    vec2 p;
-
-    if(l.intersect(s, p))
-        std::cout << p << std::endl;
-    else
-        std::cout << "No intersection" << std::endl;
-
-    std::cout << l << std::endl;
-    std::cout << s << std::endl;
-
-    std::cout << l.closest() << std::endl;
-    std::cout << l.toAngle() << std::endl;
+    { "k", "sweep the bucket count k", suiteK },
+    { "n", "sweep the number of segments, against the naive loop", suiteN },
+    { "length", "sweep the maximum segment length, against the naive loop", suiteLength },
+    { "baselines", "sweep the number of segments, against a grid, BVH and R-tree", suiteBaselines },
+    { "fixed", "run time k against FixedIRM<K> for the compiled K (ignores --range)", suiteFixed },
+    { "chains", "segment IRM against PolylineIRM on building and road scenes", suiteChains },
+    { "nearest", "sweep m, m nearest hits with a bounded heap against sorting every hit", suiteNearest },
+    { "compressed", "sweep the number of segments, IRM against read only CompressedIRM", suiteCompressed },
+    { "layout", "sweep the number of segments, IRM storing segments in input or Hilbert order", suiteLayout },
+    { "plan", "sweep the number of segments, IRM buckets searched by tree, flat scan or the planner", suitePlan },
+    { "load", "sweep the query threads, latency percentiles with optional concurrent writers", suiteLoad },
+    { "approx", "sweep the number of segments, exact counts against sampled estimates within --error", suiteApprox },
+    { "join", "sweep the number of segments, all intersecting pairs of two scenes, IRM against a plane sweep", suiteJoin },
+    { "cache", "sweep the distinct lines of a query stream, IRM against a QueryCache, checked after updates", suiteCache },
+#ifdef IRM_PAGED
+    { "paged", "sweep the memory budget of disk backed PagedIRM, against IRM in memory", suitePaged },
+#endif
+#ifdef IRM_SERVER
+    { "server", "sweep the clients pipelining queries to a QueryServer over a Unix socket", suiteServer },
+#endif
+};
 
-    std::cout << IRM::lineToTransformAngle(l) << std::endl;
-    std::cout << IRM::transformLine(l) << std::endl;
+static const size_t NUM_SUITES = sizeof(SUITES) / sizeof(SUITES[0]);
 
-    return true;
+template <size_t N>
+static std::string join(const char* const (&names)[N])
+{
+    std::string res;
+    for(size_t i = 0; i < N; i++)
+        res += std::string(i == 0 ? "" : ", ") + names[i];
+    return res;
 }
 
-static bool benchtree()
+static void usage()
 {
-    std::vector<Interval<float, int>> intervals;
-
-    for(auto i = 0; i < 1000000; i++)
-    {
-        auto v = vec2(1.0F, 2.0F + ((float)(i) / 100000.0F));
-        intervals.push_back(Interval<float, int>(v.x, v.y, i));
-    }
-
-    IntervalTree<float, int> tree(std::move(intervals));
-
-    float qp = 4.3F;
-
-    auto start = now();
-    auto sz = tree.findOverlapping(qp - EPSILON, qp + EPSILON).size();
-    auto end = now();
-
-    std::cout << "Standard Interval test took: " << (end - start) / 1000 << "us for " << sz << " results" << std::endl;
-
-    return true;
+    std::cout << "Usage: IRM [options] [suite...]\n\n"
+                 "Suites (default: all):\n";
+    for(size_t i = 0; i < NUM_SUITES; i++)
+        std::cout << "  " << SUITES[i].name << std::string(12 - std::strlen(SUITES[i].name), ' ') << SUITES[i].description << '\n';
+
+    Options d;
+    std::cout << "\nOptions:\n"
+                 "  --n N             segments per scene (" << d.n << ")\n"
+                 "  --k K             buckets (" << d.k << ")\n"
+                 "  --length L        maximum segment length (" << d.length << ")\n"
+                 "  --bound B         half extent of the scene (" << d.bound << ")\n"
+                 "  --lines L         timed query lines per trial (" << d.lines << ")\n"
+                 "  --warmup W        untimed query lines per trial (" << d.warmup << ")\n"
+                 "  --trials T        scenes per measurement (" << d.trials << ")\n"
+                 "  --threads T       query threads (" << d.threads << ")\n"
+                 "  --writers W       threads inserting and removing during the load suite (" << d.writers << ")\n"
+                 "  --inserts I       segments inserted per trial, 0 for n (" << d.inserts << ")\n"
+                 "  --removes R       removals per trial (" << d.removes << ")\n"
+                 "  --nearest M       hits kept by nearest-hit queries (" << d.nearest << ")\n"
+                 "  --budget B        share of its file PagedIRM may keep mapped (" << d.budget << ")\n"
+                 "  --error E         error bound of approximate counts, share of the candidates (" << d.error << ")\n"
+                 "  --seed S          first random seed (" << d.seed << ")\n"
+                 "  --range A:B:S     values of the swept parameter\n"
+                 "  --scene S         segment generator: " << join(SEGMENT_WORKLOADS) << " (" << d.scene << ")\n"
+                 "  --angles A        query line generator: " << join(LINE_WORKLOADS) << " (" << d.angles << ")\n"
+                 "  --file FILE       use the segments of FILE (\"ax ay bx by\" per line) as the scene\n"
+                 "  --predicate P     IRM hit test: fast or filtered (exact) (fast)\n"
+                 "  --layout L        IRM segment order: input or hilbert (input)\n"
+                 "  --plan P          IRM bucket search: tree, scan or auto (" << d.plan << ")\n"
+                 "  --json FILE       write all records to FILE as JSON\n"
+                 "  --counters-csv FILE  write the per bucket query counters of every record to FILE (IRM_INSTRUMENT builds)\n";
 }
 
-#endif
-
-int main()
+static bool parse(int argc, char** argv, Options& o, std::vector<const Suite*>& run)
 {
-    std::srand(std::time(NULL));
-
-    std::cout << "IRM (Interval Rotation Map) Benchmark" << std::endl;
-    std::cout << "Program is licensed under the MIT License. Copyright (c) 2020 Rohan A." << std::endl;
-    std::cout << "This will take some time and resources - monitor your CPU and RAM usage please.\n" << std::endl;
-
-    std::cout.precision(5);
-    std::cout << std::scientific;
-
-#ifdef TEST_VERIFY
-    if(!test() || !benchtree())
-        return 0;
-#endif
-
-    const auto TESTS = 10;
-    const auto BOUNDS = 500.0F;
-
-    const auto K = 100;
-    const auto NUM_LINES = 10;
-    const auto NUM_SEGS = 1000;
-
-#if defined(TEST_K) || defined(TEST_GENERAL)
-    const auto LENGTH = 10.0F;
-#endif
-
-#ifdef TEST_K
-    const auto MINK = 1;
-    const auto FACTORK = 5;
-    const auto MAXK = 200 + FACTORK;
-#endif
-
-#ifdef TEST_GENERAL
-    const auto MINLVL = 10000;
-    const auto FACTOR = 50000;
-    const auto MAXLVL = 1000000 + FACTOR;
-#endif
-
-#ifdef TEST_L
-    const auto MINL = EPSILON;
-    const auto FACTORL = 0.5F;
-    const auto MAXL = 50.0F + FACTORL;
-#endif
-
-    vec2 trick = vec2(0.0F, 0.0F);
-
-    // Data files
-
-    std::ofstream kt, typical, accelerated, ltt, lta;
-
-#ifdef TEST_K
-
-    kt.open("k.csv");
-    kt << "k,numsegs,numlines,intersections,createtime,space,querytime,inserttime,deletetime,queryrate,insertrate,deleterate" << std::endl;
-
-    std::cout << "Running k-value tests.\nRemaining: " << std::flush;
-
-    /* k Tests */
-    for(auto k = MINK; k < MAXK; k += FACTORK)
+    for(int i = 1; i < argc; i++)
     {
-        std::cout << (((MAXK - k) / FACTORK) + 1) << "... " << std::flush;
+        std::string a = argv[i];
 
-        size_t avgconstruct = 0;
-        size_t avgspace = 0;
-        size_t avgquery = 0;
-        size_t avgint = 0;
-        size_t avginsert = 0;
-        size_t avgdelete = 0;
+        if(a == "-h" || a == "--help")
+            return false;
 
-        for(auto i = 0; i < TESTS; i++)
+        if(a.compare(0, 2, "--") != 0)
         {
-            // Generate lines and geometry
-            auto lines = randomLines(NUM_LINES, BOUNDS);
-            auto segments = randomSegments(NUM_SEGS, BOUNDS, LENGTH);
-            auto inserts = randomSegments(NUM_SEGS, BOUNDS, LENGTH);
-
-#ifdef TEST_DEBUG
-            std::cout << "\nGENERATED\n" << std::endl;
-#endif
-
-            // Construction
-            auto acstart = now();
-            IRM irm(k, segments);
-            auto acend = now();
-
-#ifdef TEST_DEBUG
-            std::cout << "\nCONSTRUCTED\n" << std::endl;
-#endif
+            const Suite* found = nullptr;
+            for(size_t s = 0; s < NUM_SUITES; s++)
+                if(a == SUITES[s].name)
+                    found = &SUITES[s];
 
-            // Space
-            auto sz = irm.rawSize();
-
-            // Query
-            auto astart = now();
-            size_t ct = 0;
-            for(auto& l : lines)
+            if(!found)
             {
-                // Don't store result to make benchmark matched
-                ct += irm.querySize(l);
+                std::cerr << "Unknown suite: " << a << std::endl;
+                return false;
             }
-            auto aend = now();
-            avgint = ct / NUM_LINES;
-
-#ifdef TEST_DEBUG
-            std::cout << "\nQUERIED\n" << std::endl;
-#endif
 
-            // Insert
-            auto aistart = now();
-            irm.insert(inserts);
-            auto aiend = now();
-
-            // Delete
-            auto adstart = now();
-            irm.remove(0);
-            auto adend = now();
-
-            avgconstruct += acend - acstart;
-            avgspace += sz;
-            avgquery += aend - astart;
-            avginsert += aiend - aistart;
-            avgdelete += adend - adstart;
+            run.push_back(found);
+            continue;
         }
 
-        avgconstruct /= TESTS;
-        avgspace /= TESTS;
-        avgquery /= TESTS;
-        avginsert /= TESTS;
-        avgdelete /= TESTS;
-
-        kt << k << ',' << NUM_SEGS << ',' << NUM_LINES << ',' << RATE(avgint, NUM_LINES) << ',' << BIL(avgconstruct) << ',' << MIL(avgspace) << ',' <<
-              BIL(avgquery) << ',' << BIL(avginsert) << ',' << BIL(avgdelete) << ',' << RATEB(NUM_LINES, avgquery) << ',' << RATEB(NUM_SEGS, avginsert) << ',' << RATEB(NUM_SEGS, avgdelete) << std::endl;
-    }
-
-    kt.close();
-
-    std::cout << "Done\nCompleted k-value tests.\n" << std::endl;
-#endif
-
-#ifdef TEST_GENERAL
-
-    typical.open("typical.csv");
-    typical << "trial,numsegs,numlines,intersections,createtime,space,querytime,inserttime,deletetime,queryrate,insertrate,deleterate" << std::endl;
-
-    accelerated.open("accelerated.csv");
-    accelerated << "trial,k,numsegs,numlines,intersections,createtime,space,querytime,inserttime,deletetime,queryrate,insertrate,deleterate" << std::endl;
-
-    std::cout << "Running general tests.\nRemaining: " << std::flush;
-
-    /* General Tests */
-    for(auto u = MINLVL; u < MAXLVL; u += FACTOR)
-    {
-        std::cout << (((MAXLVL - u) / FACTOR) + 1) << "... " << std::flush;
-
-        size_t tavgconstruct = 0;
-        size_t tavgspace = 0;
-        size_t tavgquery = 0;
-        size_t tavgint = 0;
-        size_t tavginsert = 0;
-        size_t tavgdelete = 0;
-
-        size_t aavgconstruct = 0;
-        size_t aavgspace = 0;
-        size_t aavgquery = 0;
-        size_t aavgint = 0;
-        size_t aavginsert = 0;
-        size_t aavgdelete = 0;
-
-        for(auto i = 0; i < TESTS; i++)
+        if(i + 1 >= argc)
         {
-            // Generate lines and geometry
-            auto lines = randomLines(NUM_LINES, BOUNDS);
-            auto segments = randomSegments(u, BOUNDS, LENGTH);
-            auto inserts = randomSegments(u, BOUNDS, LENGTH);
-
-            // Typical test
-
-            // No construction
-            // No space
+            std::cerr << "Missing value for " << a << std::endl;
+            return false;
+        }
 
-            // Query
-            auto tstart = now();
-            vec2 tmp = vec2();
-            for(auto& l : lines)
+        const char* v = argv[++i];
+
+        if(a == "--n") o.n = (unsigned int)(std::strtoul(v, nullptr, 10));
+        else if(a == "--k") o.k = (unsigned int)(std::strtoul(v, nullptr, 10));
+        else if(a == "--length") o.length = std::strtof(v, nullptr);
+        else if(a == "--bound") o.bound = std::strtof(v, nullptr);
+        else if(a == "--lines") o.lines = (unsigned int)(std::strtoul(v, nullptr, 10));
+        else if(a == "--warmup") o.warmup = (unsigned int)(std::strtoul(v, nullptr, 10));
+        else if(a == "--trials") o.trials = (unsigned int)(std::strtoul(v, nullptr, 10));
+        else if(a == "--threads") o.threads = (unsigned int)(std::strtoul(v, nullptr, 10));
+        else if(a == "--writers") o.writers = (unsigned int)(std::strtoul(v, nullptr, 10));
+        else if(a == "--inserts") o.inserts = (unsigned int)(std::strtoul(v, nullptr, 10));
+        else if(a == "--nearest") o.nearest = (unsigned int)(std::strtoul(v, nullptr, 10));
+        else if(a == "--budget") o.budget = std::strtod(v, nullptr);
+        else if(a == "--error") o.error = std::strtod(v, nullptr);
+        else if(a == "--removes") o.removes = (unsigned int)(std::strtoul(v, nullptr, 10));
+        else if(a == "--seed") o.seed = (unsigned int)(std::strtoul(v, nullptr, 10));
+        else if(a == "--json") o.json = v;
+        else if(a == "--counters-csv") o.countersCsv = v;
+        else if(a == "--scene") o.scene = v;
+        else if(a == "--angles") o.angles = v;
+        else if(a == "--file") o.file = v;
+        else if(a == "--predicate")
+        {
+            if(std::strcmp(v, "fast") != 0 && std::strcmp(v, "filtered") != 0)
             {
-                for(auto& s : segments)
-                {
-                    if(l.intersect(s, tmp))
-                    {
-                        tavgint++;
-                    }
-                }
+                std::cerr << "Unknown predicate: " << v << std::endl;
+                return false;
             }
-            auto tend = now();
-
-            // Insert
-            auto tistart = now();
-            std::vector<segment> tt;
-            tt.insert(tt.end(), inserts.begin(), inserts.end());
-            auto tiend = now();
-
-            // Delete
-            auto tdstart = now();
-            tt.erase(tt.begin() + u, tt.end());
-            auto tdend = now();
-
-            tavgconstruct += 0;
-            tavgspace += 0;
-            tavgquery += tend - tstart;
-            tavginsert += tiend - tistart;
-            tavgdelete += tdend - tdstart;
-
-            // Accelerated test
-
-#ifdef TEST_DEBUG
-            std::cout << "\nTYPICAL\n" << std::endl;
-#endif
-            // Construction
-            auto acstart = now();
-            IRM irm(K, segments);
-            auto acend = now();
-
-            // Space
-            auto sz = irm.rawSize();
-
-            // Query
-            auto astart = now();
-            for(auto& l : lines)
+            o.filtered = std::strcmp(v, "filtered") == 0;
+        }
+        else if(a == "--layout")
+        {
+            if(std::strcmp(v, "input") != 0 && std::strcmp(v, "hilbert") != 0)
             {
-                // Don't store result to make benchmark matched
-                aavgint += irm.querySize(l);
+                std::cerr << "Unknown layout: " << v << std::endl;
+                return false;
             }
-            auto aend = now();
-
-            // Insert
-            auto aistart = now();
-            irm.insert(inserts);
-            auto aiend = now();
-
-            // Delete
-            auto adstart = now();
-            irm.remove(0);
-            auto adend = now();
-
-            aavgconstruct += acend - acstart;
-            aavgspace += sz;
-            aavgquery += aend - astart;
-            aavginsert += aiend - aistart;
-            aavgdelete += adend - adstart;
-
-#ifdef TEST_DEBUG
-            std::cout << "\nACCELERATED\n" << std::endl;
-#endif
+            o.hilbert = std::strcmp(v, "hilbert") == 0;
+        }
+        else if(a == "--plan")
+        {
+            if(std::strcmp(v, "tree") != 0 && std::strcmp(v, "scan") != 0 && std::strcmp(v, "auto") != 0)
+            {
+                std::cerr << "Unknown plan: " << v << std::endl;
+                return false;
+            }
+            o.plan = v;
         }
+        else if(a == "--range")
+        {
+            if(std::sscanf(v, "%lf:%lf:%lf", &o.min, &o.max, &o.step) != 3 || o.step <= 0.0)
+            {
+                std::cerr << "Invalid range: " << v << std::endl;
+                return false;
+            }
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << a << std::endl;
+            return false;
+        }
+    }
+
+    if(o.k == 0 || o.trials == 0 || o.threads == 0)
+    {
+        std::cerr << "k, trials and threads must be positive" << std::endl;
+        return false;
+    }
 
-        tavgint /= TESTS;
-        aavgint /= TESTS;
-
-        tavgconstruct /= TESTS;
-        tavgspace /= TESTS;
-        tavgquery /= TESTS;
-        tavginsert /= TESTS;
-        tavgdelete /= TESTS;
-
-        aavgconstruct /= TESTS;
-        aavgspace /= TESTS;
-        aavgquery /= TESTS;
-        aavginsert /= TESTS;
-        aavgdelete /= TESTS;
-
-        typical << ((u - MINLVL) / FACTOR) + 1 << ',' << u << ',' << NUM_LINES << ',' << RATE(tavgint, NUM_LINES) << ',' << 0 << ',' << 0 << ',' << BIL(tavgquery) << ',' << BIL(tavginsert) << ',' << BIL(tavgdelete) << ',' <<
-                   RATEB(NUM_LINES, tavgquery) << ',' << RATEB(NUM_SEGS, tavginsert)  << ',' << RATEB(NUM_SEGS, tavgdelete) << std::endl;
-        accelerated << ((u - MINLVL) / FACTOR) + 1 << ',' << K << ',' << u << ',' << NUM_LINES << ',' << RATE(aavgint, NUM_LINES) << ',' << BIL(aavgconstruct) << ',' << MIL(aavgspace) << ',' << BIL(aavgquery) << ',' << BIL(aavginsert) << ',' << BIL(aavgdelete) << ',' <<
-                       RATEB(NUM_LINES, aavgquery) << ',' << RATEB(NUM_SEGS, aavginsert)  << ',' << RATEB(NUM_SEGS, aavgdelete) << std::endl;
+    if(!(o.error > 0.0))
+    {
+        std::cerr << "error must be positive" << std::endl;
+        return false;
     }
 
-    typical.close();
-    accelerated.close();
+    if(!isSegmentWorkload(o.scene) || !isLineWorkload(o.angles))
+    {
+        std::cerr << "Unknown scene or angle distribution" << std::endl;
+        return false;
+    }
 
-    std::cout << "Done\nCompleted general tests.\n" << std::endl;
+    if(!o.file.empty())
+    {
+        std::vector<segment> segs;
+        std::string error;
 
-#endif
+        if(!loadSegments(o.file, segs, error))
+        {
+            std::cerr << error << std::endl;
+            return false;
+        }
 
-#ifdef TEST_L
+        // Sweeps and inserts are sized by the file unless asked otherwise
+        o.scene = "file";
+        o.n = std::min(o.n, (unsigned int)(segs.size()));
+        o.bound = std::max(extentOf(segs), EPSILON);
+        o.imported = std::make_shared<const std::vector<segment>>(std::move(segs));
+    }
 
-    ltt.open("ltt.csv");
-    ltt << "l,numsegs,numlines,intersections,createtime,space,querytime,inserttime,deletetime,queryrate,insertrate,deleterate" << std::endl;
+    if(run.empty())
+        for(size_t s = 0; s < NUM_SUITES; s++)
+            run.push_back(&SUITES[s]);
 
-    lta.open("lta.csv");
-    lta << "l,numsegs,numlines,intersections,createtime,space,querytime,inserttime,deletetime,queryrate,insertrate,deleterate" << std::endl;
+    return true;
+}
 
-    std::cout << "Running l-value tests.\nRemaining: " << std::flush;
+static void print(const Record& r)
+{
+    std::cout << r.suite << ' ' << r.method;
+    for(auto& p : r.params)
+        std::cout << ' ' << p.first << '=' << p.second;
+    for(auto& p : r.extra)
+        std::cout << ' ' << p.first << '=' << p.second;
+
+    std::cout << " | build " << r.build << "s, " << r.bytes / 1e6 << "MB, median " << r.query.median << "ns, p99 " << r.query.p99 << "ns, p99.9 " << r.query.p999 << "ns, max " <<
+                 r.query.max << "ns, " << r.throughput << " q/s, hits " << r.hits << std::endl;
+}
+
+static void write(JsonWriter& w, const Options& o, const std::vector<Record>& records)
+{
+    w.begin('{');
+
+    w.key("options");
+    w.begin('{');
+    w.field("seed", (double)(o.seed));
+    w.field("trials", (double)(o.trials));
+    w.field("warmup", (double)(o.warmup));
+    w.field("bound", (double)(o.bound));
+    w.field("inserts", (double)(o.insertCount()));
+    w.field("removes", (double)(o.removes));
+    w.field("scene", o.scene);
+    w.field("angles", o.angles);
+    w.field("predicate", std::string(o.filtered ? "filtered" : "fast"));
+    w.field("layout", std::string(o.hilbert ? "hilbert" : "input"));
+    w.field("plan", o.plan);
+    w.field("error", o.error);
+    if(!o.file.empty())
+        w.field("file", o.file);
+#ifdef IRM_INSTRUMENT
+    w.field("instrumented", 1.0);
+#endif
+    w.end('}');
 
-    /* l Tests */
-    for(auto l = MINL; l < MAXL; l += FACTORL)
+    w.key("records");
+    w.begin('[');
+    for(const Record& r : records)
     {
-        std::cout << (unsigned int)(((MAXL - l) / FACTORL) + 1) << "... " << std::flush;
-
-        size_t tavgconstruct = 0;
-        size_t tavgspace = 0;
-        size_t tavgquery = 0;
-        size_t tavgint = 0;
-        size_t tavginsert = 0;
-        size_t tavgdelete = 0;
-
-        size_t aavgconstruct = 0;
-        size_t aavgspace = 0;
-        size_t aavgquery = 0;
-        size_t aavgint = 0;
-        size_t aavginsert = 0;
-        size_t aavgdelete = 0;
-
-        for(auto i = 0; i < TESTS; i++)
+        w.begin('{');
+        w.field("suite", r.suite);
+        w.field("method", r.method);
+
+        for(auto& p : r.params)
+            w.field(p.first, p.second);
+        for(auto& p : r.extra)
+            w.field(p.first, p.second);
+
+        w.field("build", r.build);
+        w.field("bytes", r.bytes);
+        w.field("hits", r.hits);
+        w.field("queries", (double)(r.query.count));
+        w.field("mean", r.query.mean);
+        w.field("median", r.query.median);
+        w.field("p99", r.query.p99);
+        w.field("p999", r.query.p999);
+        w.field("max", r.query.max);
+        w.field("throughput", r.throughput);
+        w.field("insert", r.insert);
+        w.field("remove", r.remove);
+
+        if(!r.counters.empty())
         {
-            // Generate lines and geometry
-            auto lines = randomLines(NUM_LINES, BOUNDS);
-            auto segments = randomSegments(NUM_SEGS, BOUNDS, l);
-            auto inserts = randomSegments(NUM_SEGS, BOUNDS, l);
+            std::ostringstream c;
+            writeCountersJSON(c, r.counters);
+            w.key("counters");
+            w.raw(c.str());
+        }
 
-#ifdef TEST_DEBUG
-            std::cout << "\nGENERATED\n" << std::endl;
-#endif
+        w.end('}');
+    }
+    w.end(']');
 
-            // Typical test
+    w.end('}');
+}
 
-            // No construction
-            // No space
+int main(int argc, char** argv)
+{
+    Options o;
+    std::vector<const Suite*> run;
 
-            // Query
-            auto tstart = now();
-            vec2 tmp = vec2();
-            for(auto& l : lines)
-            {
-                for(auto& s : segments)
-                {
-                    if(l.intersect(s, tmp))
-                    {
-                        tavgint++;
-                    }
-                }
-            }
-            auto tend = now();
-
-            // Insert
-            auto tistart = now();
-            std::vector<segment> tt;
-            tt.insert(tt.end(), inserts.begin(), inserts.end());
-            auto tiend = now();
-
-            // Delete
-            auto tdstart = now();
-            tt.erase(tt.begin() + NUM_SEGS, tt.end());
-            auto tdend = now();
-
-            tavgconstruct += 0;
-            tavgspace += 0;
-            tavgquery += tend - tstart;
-            tavginsert += tiend - tistart;
-            tavgdelete += tdend - tdstart;
-
-#ifdef TEST_DEBUG
-            std::cout << "\nTYPICAL\n" << std::endl;
-#endif
+    if(!parse(argc, argv, o, run))
+    {
+        usage();
+        return 1;
+    }
 
-            // Accelerated
+    std::cout << "IRM (Interval Rotation Map) Benchmark" << std::endl;
+    std::cout << "Program is licensed under the MIT License. Copyright (c) 2020 Rohan A.\n" << std::endl;
 
-            // Construction
-            auto acstart = now();
-            IRM irm(K, segments);
-            auto acend = now();
+    std::cout.precision(5);
 
-#ifdef TEST_DEBUG
-            std::cout << "\nCONSTRUCTED\n" << std::endl;
-#endif
+    std::vector<Record> records;
 
-            // Space
-            auto sz = irm.rawSize();
+    for(const Suite* s : run)
+    {
+        std::cout << "Running " << s->name << " suite." << std::endl;
 
-            // Query
-            auto astart = now();
-            for(auto& l : lines)
-            {
-                // Don't store result to make benchmark matched
-                aavgint += irm.querySize(l);
-            }
-            auto aend = now();
+        size_t first = records.size();
+        s->run(o, records);
 
-#ifdef TEST_DEBUG
-            std::cout << "\nQUERIED\n" << std::endl;
-#endif
+        for(size_t i = first; i < records.size(); i++)
+            print(records[i]);
 
-            // Insert
-            auto aistart = now();
-            irm.insert(inserts);
-            auto aiend = now();
-
-            // Delete
-            auto adstart = now();
-            irm.remove(0);
-            auto adend = now();
-
-            aavgconstruct += acend - acstart;
-            aavgspace += sz;
-            aavgquery += aend - astart;
-            aavginsert += aiend - aistart;
-            aavgdelete += adend - adstart;
-        }
+        std::cout << "Completed " << s->name << " suite.\n" << std::endl;
+    }
+
+    if(!o.json.empty())
+    {
+        std::ofstream out(o.json.c_str());
+        JsonWriter w(out);
+        write(w, o, records);
+        out << std::endl;
 
-        tavgint /= TESTS;
-        aavgint /= TESTS;
-
-        tavgconstruct /= TESTS;
-        tavgspace /= TESTS;
-        tavgquery /= TESTS;
-        tavginsert /= TESTS;
-        tavgdelete /= TESTS;
-
-        aavgconstruct /= TESTS;
-        aavgspace /= TESTS;
-        aavgquery /= TESTS;
-        aavginsert /= TESTS;
-        aavgdelete /= TESTS;
-
-        ltt << l << ',' << NUM_SEGS << ',' << NUM_LINES << ',' << RATE(tavgint, NUM_LINES) << ',' << BIL(tavgconstruct) << ',' << MIL(tavgspace) << ',' << BIL(tavgquery) << ',' << BIL(tavginsert) << ',' << BIL(tavgdelete) << ',' <<
-               RATEB(NUM_LINES, tavgquery) << ',' << RATEB(NUM_SEGS, tavginsert)  << ',' << RATEB(NUM_SEGS, tavgdelete) << std::endl;
-        lta << l << ',' << NUM_SEGS << ',' << NUM_LINES << ',' << RATE(aavgint, NUM_LINES) << ',' << BIL(aavgconstruct) << ',' << MIL(aavgspace) << ',' << BIL(aavgquery) << ',' << BIL(aavginsert) << ',' << BIL(aavgdelete) << ',' <<
-               RATEB(NUM_LINES, aavgquery) << ',' << RATEB(NUM_SEGS, aavginsert)  << ',' << RATEB(NUM_SEGS, aavgdelete) << std::endl;
+        std::cout << "Wrote " << records.size() << " records to " << o.json << std::endl;
     }
 
-    ltt.close();
-    lta.close();
+    if(!o.countersCsv.empty())
+    {
+        // Records are numbered in the order of the JSON output
+        std::ofstream out(o.countersCsv.c_str());
+        out << "record,suite,method,bucket,queries,nodes,scanned,candidates,hits,fallbacks,scans,false_positive_rate\n";
+        for(size_t i = 0; i < records.size(); i++)
+            writeCountersCSV(out, records[i].counters, std::to_string(i) + ',' + records[i].suite + ',' + records[i].method + ',');
 
-    std::cout << "Done\nCompleted l-value tests.\n" << std::endl;
-#endif
+        std::cout << "Wrote the counters of " << records.size() << " records to " << o.countersCsv << std::endl;
+    }
 
-    // Ensure compiler doesn't optimize benchmarks away
-    std::cout << "Ignore this: " << (trick.x - trick.y > 0.0F ? ">" : "<") << std::endl;
     std::cout << "\nBenchmark completed." << std::endl;
 
     return 0;
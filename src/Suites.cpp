@@ -0,0 +1,688 @@
+#include "Benchmark.hpp"
+#include "Baselines.hpp"
+
+static Record with(Record r, const Options& o)
+{
+    r.params.push_back(std::make_pair(std::string("n"), (double)(o.n)));
+    r.params.push_back(std::make_pair(std::string("k"), (double)(o.k)));
+    r.params.push_back(std::make_pair(std::string("length"), (double)(o.length)));
+    r.params.push_back(std::make_pair(std::string("lines"), (double)(o.lines)));
+    r.params.push_back(std::make_pair(std::string("threads"), (double)(o.threads)));
+    return r;
+}
+
+/* k Tests */
+void suiteK(const Options& o, std::vector<Record>& out)
+{
+    for(double k : sweep(o, 1.0, 201.0, 5.0))
+    {
+        Options c = o;
+        c.k = (unsigned int)(k);
+
+        out.push_back(with(measure<IRMIndex<>>(c, "k", "irm"), c));
+    }
+}
+
+/* General Tests */
+void suiteN(const Options& o, std::vector<Record>& out)
+{
+    for(double n : sweep(o, 10000.0, 1010000.0, 50000.0))
+    {
+        Options c = o;
+        c.n = (unsigned int)(n);
+
+        out.push_back(with(measure<NaiveIndex>(c, "n", "naive"), c));
+        out.push_back(with(measure<IRMIndex<>>(c, "n", "irm"), c));
+    }
+}
+
+/* l Tests */
+void suiteLength(const Options& o, std::vector<Record>& out)
+{
+    for(double l : sweep(o, EPSILON, 50.0, 0.5))
+    {
+        Options c = o;
+        c.length = (float)(l);
+
+        out.push_back(with(measure<NaiveIndex>(c, "length", "naive"), c));
+        out.push_back(with(measure<IRMIndex<>>(c, "length", "irm"), c));
+    }
+}
+
+/* Competing indexes */
+void suiteBaselines(const Options& o, std::vector<Record>& out)
+{
+    for(double n : sweep(o, 10000.0, 210000.0, 50000.0))
+    {
+        Options c = o;
+        c.n = (unsigned int)(n);
+
+        out.push_back(with(measure<NaiveIndex>(c, "baselines", "naive"), c));
+        out.push_back(with(measure<GridIndex>(c, "baselines", "grid"), c));
+        out.push_back(with(measure<BVHIndex>(c, "baselines", "bvh"), c));
+        out.push_back(with(measure<RTreeIndex>(c, "baselines", "rtree"), c));
+        out.push_back(with(measure<IRMIndex<>>(c, "baselines", "irm"), c));
+    }
+}
+
+/* Compile-time k */
+template <unsigned int K>
+static void fixedK(const Options& o, std::vector<Record>& out)
+{
+    Options c = o;
+    c.k = K;
+
+    out.push_back(with(measure<IRMIndex<>>(c, "fixed", "irm"), c));
+    out.push_back(with(measure<IRMIndex<FixedIRM<K>>>(c, "fixed", "fixed"), c));
+}
+
+void suiteFixed(const Options& o, std::vector<Record>& out)
+{
+    fixedK<16>(o, out);
+    fixedK<32>(o, out);
+    fixedK<64>(o, out);
+    fixedK<100>(o, out);
+    fixedK<128>(o, out);
+    fixedK<256>(o, out);
+}
+
+/* Connected geometry */
+void suiteChains(const Options& o, std::vector<Record>& out)
+{
+    for(const char* scene : { "buildings", "roads" })
+    {
+        for(double n : sweep(o, 10000.0, 110000.0, 50000.0))
+        {
+            Options c = o;
+            c.n = (unsigned int)(n);
+            c.scene = scene;
+
+            out.push_back(with(measure<IRMIndex<>>(c, "chains", std::string("irm/") + scene), c));
+            out.push_back(with(measure<PolylineIndex>(c, "chains", std::string("polyline/") + scene), c));
+        }
+    }
+}
+
+/* m nearest intersections */
+void suiteNearest(const Options& o, std::vector<Record>& out)
+{
+    for(double m : sweep(o, 1.0, 65.0, 16.0))
+    {
+        Options c = o;
+        c.nearest = (unsigned int)(m);
+
+        Record r = with(measure<NearestIndex<false>>(c, "nearest", "heap"), c);
+        r.params.push_back(std::make_pair(std::string("m"), m));
+        out.push_back(r);
+
+        r = with(measure<NearestIndex<true>>(c, "nearest", "sort"), c);
+        r.params.push_back(std::make_pair(std::string("m"), m));
+        out.push_back(r);
+    }
+}
+
+/* Compressed buckets */
+void suiteCompressed(const Options& o, std::vector<Record>& out)
+{
+    for(double n : sweep(o, 10000.0, 210000.0, 50000.0))
+    {
+        Options c = o;
+        c.n = (unsigned int)(n);
+
+        out.push_back(with(measure<IRMIndex<>>(c, "compressed", "irm"), c));
+        out.push_back(with(measure<CompressedIndex>(c, "compressed", "compressed"), c));
+    }
+}
+
+/* Segment storage order */
+void suiteLayout(const Options& o, std::vector<Record>& out)
+{
+    for(double n : sweep(o, 100000.0, 1100000.0, 500000.0))
+    {
+        Options c = o;
+        c.n = (unsigned int)(n);
+
+        c.hilbert = false;
+        out.push_back(with(measure<IRMIndex<>>(c, "layout", "input"), c));
+
+        c.hilbert = true;
+        out.push_back(with(measure<IRMIndex<>>(c, "layout", "hilbert"), c));
+    }
+}
+
+/* Tree traversal against flat scans */
+void suitePlan(const Options& o, std::vector<Record>& out)
+{
+    for(const char* scene : { "uniform", "long" })
+    {
+        for(double n : sweep(o, 1000.0, 201000.0, 50000.0))
+        {
+            Options c = o;
+            c.n = (unsigned int)(n);
+            c.scene = scene;
+
+            for(const char* plan : { "tree", "scan", "auto" })
+            {
+                c.plan = plan;
+                Record r = with(measure<IRMIndex<>>(c, "plan", std::string(plan) + "/" + scene), c);
+
+                // Buckets the planner chose to scan, on the first scene
+                IRM irm(c.k, Scene(c, 0).segments);
+                irm.setPlan(c.plan == "scan" ? IRM::SCAN : (c.plan == "auto" ? IRM::AUTO : IRM::TREE));
+
+                size_t scans = 0;
+                for(const IRM::BucketStats& b : irm.statistics().buckets)
+                    scans += b.scan ? 1 : 0;
+
+                r.extra.push_back(std::make_pair(std::string("scan_buckets"), (double)(scans)));
+                out.push_back(r);
+            }
+        }
+    }
+}
+
+/* Concurrent load */
+
+// o.threads readers each query o.lines lines against one shared IRM while
+// o.writers writers insert and remove segments. Writers take turns copying
+// the published IRM (the copy shares its trees), updating the copy,
+// publishing it with std::atomic_store and then advancing a version number.
+// The shared_ptr atomics of libstdc++ take a lock from a global pool, so
+// readers don't call them per query: each keeps its own reference and only
+// reloads it when the version moved. A query thus costs one more atomic
+// load than on a private IRM, and the reload after a publication is the
+// only time a reader can wait for a writer. Latencies go to one histogram
+// per reader.
+static Record measureLoad(const Options& o)
+{
+    Trials acc;
+    Histogram latency;
+    size_t writes = 0;
+    unsigned long int writeTime = 0;
+
+    for(unsigned int trial = 0; trial < o.trials; trial++)
+    {
+        Scene scene(o, trial);
+
+        unsigned long int start = now();
+        std::shared_ptr<IRM> index = std::make_shared<IRM>(o.k, scene.segments);
+        acc.build += now() - start;
+        acc.bytes += index->statistics().bytes();
+
+        for(const line& l : scene.warmup)
+            acc.warmHits += index->querySize(l);
+
+        std::vector<Histogram> latencies(o.threads);
+        std::vector<size_t> hits(o.threads, 0), updates(o.writers, 0);
+        std::atomic<unsigned int> readers(o.threads);
+        std::atomic<uint64_t> version(0);
+        std::mutex turn;
+
+        std::vector<std::thread> pool;
+        start = now();
+
+        for(unsigned int w = 0; w < o.writers; w++)
+        {
+            pool.push_back(std::thread([&, w]()
+            {
+                size_t u = w;
+                while(readers.load() != 0 && !scene.inserts.empty())
+                {
+                    std::lock_guard<std::mutex> lock(turn);
+                    std::shared_ptr<IRM> next = std::make_shared<IRM>(*std::atomic_load(&index));
+
+                    // Alternate inserts and removals so the size stays put
+                    if(u % 2 == 0 || next->count() == 0)
+                        next->insert(std::vector<segment>(1, scene.inserts[u % scene.inserts.size()]));
+                    else
+                        next->remove(u % next->count());
+
+                    std::atomic_store(&index, next);
+                    version.fetch_add(1, std::memory_order_release);
+                    updates[w]++;
+                    u += o.writers;
+                }
+            }));
+        }
+
+        for(unsigned int t = 0; t < o.threads; t++)
+        {
+            pool.push_back(std::thread([&, t]()
+            {
+                const size_t lines = scene.lines.size();
+                uint64_t seen = version.load(std::memory_order_acquire);
+                std::shared_ptr<IRM> current = std::atomic_load(&index);
+
+                for(size_t q = 0; q < lines; q++)
+                {
+                    // Every reader walks all lines, each from its own offset
+                    const line& l = scene.lines[(q + lines * t / o.threads) % lines];
+
+                    unsigned long int qs = now();
+                    const uint64_t v = version.load(std::memory_order_acquire);
+                    if(v != seen)
+                    {
+                        seen = v;
+                        current = std::atomic_load(&index);
+                    }
+                    hits[t] += current->querySize(l);
+                    latencies[t].record(now() - qs);
+                }
+                readers--;
+            }));
+        }
+
+        for(std::thread& t : pool)
+            t.join();
+
+        const unsigned long int elapsed = now() - start;
+        acc.queryTime += elapsed;
+
+        for(unsigned int t = 0; t < o.threads; t++)
+        {
+            latency += latencies[t];
+            acc.hits += hits[t];
+        }
+
+        for(size_t u : updates)
+            writes += u;
+        writeTime += elapsed;
+    }
+
+    Record r = acc.finish("load", "irm", o.trials);
+    r.query = Summary::of(latency);
+    r.hits = latency.count() == 0 ? 0.0 : (double)(acc.hits) / (double)(latency.count());
+    r.throughput = acc.queryTime == 0 ? 0.0 : (double)(latency.count()) / BIL(acc.queryTime);
+    r.extra.push_back(std::make_pair(std::string("writers"), (double)(o.writers)));
+    r.extra.push_back(std::make_pair(std::string("writes_per_second"), writeTime == 0 ? 0.0 : (double)(writes) / BIL(writeTime)));
+    return r;
+}
+
+void suiteLoad(const Options& o, std::vector<Record>& out)
+{
+    for(double t : sweep(o, 1.0, 8.0, 1.0))
+    {
+        Options c = o;
+        c.threads = (unsigned int)(t);
+
+        out.push_back(with(measureLoad(c), c));
+    }
+}
+
+/* Approximate counts */
+
+// estimateSize within o.error at 95% confidence, timed like measure times
+// querySize. Every line is also counted exactly, untimed, for the share of
+// intervals holding the true count, the mean relative error of the
+// estimates and the share of candidates sampled.
+static Record measureApprox(const Options& o)
+{
+    Trials acc;
+    size_t covered = 0, queries = 0, candidates = 0, sampled = 0;
+    double error = 0.0;
+
+    for(unsigned int trial = 0; trial < o.trials; trial++)
+    {
+        Scene scene(o, trial);
+
+        unsigned long int start = now();
+        IRM irm(o.k, scene.segments);
+        irm.setSampling(o.error, 0.95);
+        acc.build += now() - start;
+        acc.bytes += irm.statistics().bytes();
+
+        for(const line& l : scene.warmup)
+            acc.warmHits += irm.estimateSize(l).sampled;
+
+        for(const line& l : scene.lines)
+        {
+            start = now();
+            IRM::Estimate e = irm.estimateSize(l);
+            unsigned long int elapsed = now() - start;
+
+            acc.latencies.push_back(elapsed);
+            acc.queryTime += elapsed;
+            acc.hits += (size_t)(std::llround(e.count));
+
+            const double exact = (double)(irm.querySize(l));
+            covered += e.low <= exact && exact <= e.high ? 1 : 0;
+            error += exact == 0.0 ? 0.0 : std::fabs(e.count - exact) / exact;
+            candidates += e.candidates;
+            sampled += e.sampled;
+            queries++;
+        }
+    }
+
+    Record r = acc.finish("approx", "approx", o.trials);
+    r.extra.push_back(std::make_pair(std::string("error"), o.error));
+    r.extra.push_back(std::make_pair(std::string("coverage"), queries == 0 ? 0.0 : (double)(covered) / (double)(queries)));
+    r.extra.push_back(std::make_pair(std::string("relative_error"), queries == 0 ? 0.0 : error / (double)(queries)));
+    r.extra.push_back(std::make_pair(std::string("sampled"), candidates == 0 ? 0.0 : (double)(sampled) / (double)(candidates)));
+    return r;
+}
+
+void suiteApprox(const Options& o, std::vector<Record>& out)
+{
+    for(double n : sweep(o, 10000.0, 1010000.0, 250000.0))
+    {
+        Options c = o;
+        c.n = (unsigned int)(n);
+
+        out.push_back(with(measure<IRMIndex<>>(c, "approx", "exact"), c));
+        out.push_back(with(measureApprox(c), c));
+    }
+}
+
+/* Spatial join */
+
+// Joins the inserts of each scene (n probes by default) against its
+// segments, with spatialJoin on o.threads threads or the plane sweep on one.
+// The latency columns are whole joins, one per trial; throughput is probes
+// per second and hits are pairs per probe. IRM builds are timed apart from
+// the joins, the sweep sorts inside the join.
+static Record measureJoin(const Options& o, bool irm)
+{
+    Trials acc;
+    std::vector<unsigned long int> joins;
+    size_t probes = 0, pairs = 0;
+
+    for(unsigned int trial = 0; trial < o.trials; trial++)
+    {
+        Scene scene(o, trial);
+        std::atomic<size_t> found(0);
+        unsigned long int start;
+
+        if(irm)
+        {
+            start = now();
+            IRM index(o.k, scene.segments);
+            acc.build += now() - start;
+            acc.bytes += index.statistics().bytes();
+
+            start = now();
+            spatialJoin(index, scene.inserts, [&](size_t, const segment&) { found.fetch_add(1, std::memory_order_relaxed); }, o.threads);
+        }
+        else
+        {
+            start = now();
+            sweepJoin(scene.inserts, scene.segments, [&](size_t, size_t) { found++; });
+        }
+
+        const unsigned long int elapsed = now() - start;
+        joins.push_back(elapsed);
+        acc.queryTime += elapsed;
+
+        probes += scene.inserts.size();
+        pairs += found.load();
+    }
+
+    Record r = acc.finish("join", irm ? "irm" : "sweep", o.trials);
+    r.query = Summary::of(joins);
+    r.hits = probes == 0 ? 0.0 : (double)(pairs) / (double)(probes);
+    r.throughput = acc.queryTime == 0 ? 0.0 : (double)(probes) / BIL(acc.queryTime);
+    r.extra.push_back(std::make_pair(std::string("pairs"), (double)(pairs) / (double)(o.trials)));
+    return r;
+}
+
+void suiteJoin(const Options& o, std::vector<Record>& out)
+{
+    for(double n : sweep(o, 10000.0, 210000.0, 50000.0))
+    {
+        Options c = o;
+        c.n = (unsigned int)(n);
+
+        out.push_back(with(measureJoin(c, false), c));
+        out.push_back(with(measureJoin(c, true), c));
+    }
+}
+
+/* Query cache */
+
+// Answers a stream of o.lines queries cycling through the first `distinct`
+// lines of the scene, once with IRM::querySize (cached false) and once
+// through a QueryCache large enough for all of them (cached true), so all
+// but the first pass hits. Then, untimed, the IRM is changed by insert,
+// flush, update, remove, setPlan and setPredicate, and after each step every
+// line is asked from the cache twice and from the IRM; any difference
+// throws.
+static Record measureCache(const Options& o, size_t distinct, bool cached)
+{
+    Trials acc;
+    QueryCache::Stats stats;
+
+    for(unsigned int trial = 0; trial < o.trials; trial++)
+    {
+        Scene scene(o, trial);
+
+        unsigned long int start = now();
+        IRM irm(o.k, scene.segments, 1024, o.hilbert ? IRM::HILBERT : IRM::INPUT);
+        irm.setPredicate(o.filtered ? IRM::FILTERED : IRM::FAST);
+        irm.setPlan(o.plan == "scan" ? IRM::SCAN : (o.plan == "auto" ? IRM::AUTO : IRM::TREE));
+        acc.build += now() - start;
+        acc.bytes += irm.statistics().bytes();
+
+        for(const line& l : scene.warmup)
+            acc.warmHits += irm.querySize(l);
+
+        QueryCache cache(irm, distinct);
+        for(size_t q = 0; q < scene.lines.size(); q++)
+        {
+            const line& l = scene.lines[q % distinct];
+
+            start = now();
+            size_t h = cached ? cache.querySize(l) : irm.querySize(l);
+            unsigned long int elapsed = now() - start;
+
+            acc.latencies.push_back(elapsed);
+            acc.queryTime += elapsed;
+            acc.hits += h;
+        }
+
+        if(!cached)
+            continue;
+
+        const QueryCache::Stats& s = cache.statistics();
+        stats.hits += s.hits;
+        stats.misses += s.misses;
+        stats.hitTime += s.hitTime;
+        stats.missTime += s.missTime;
+
+        const size_t updates = std::min((size_t)(16), std::min(scene.inserts.size(), scene.segments.size()));
+        std::vector<size_t> handles;
+        for(size_t u = 0; u < updates; u++)
+            handles.push_back(u * (scene.segments.size() / updates));
+
+        // Few enough inserts to stay staged until the flush
+        const size_t staged = std::min((size_t)(100), scene.inserts.size() - updates);
+        const std::vector<segment> moved(scene.inserts.begin(), scene.inserts.begin() + updates);
+        const std::vector<segment> added(scene.inserts.begin() + updates, scene.inserts.begin() + updates + staged);
+
+        const char* steps[] = { "insert", "flush", "update", "remove", "setPlan", "setPredicate" };
+        for(const char* step : steps)
+        {
+            const std::string name(step);
+            if(name == "insert")
+                irm.insert(added);
+            else if(name == "flush")
+                irm.flush();
+            else if(name == "update")
+                irm.update(handles, moved);
+            else if(name == "remove")
+                irm.remove(0);
+            else if(name == "setPlan")
+                irm.setPlan(o.plan == "scan" ? IRM::TREE : IRM::SCAN);
+            else
+                irm.setPredicate(o.filtered ? IRM::FAST : IRM::FILTERED);
+
+            for(size_t u = 0; u < distinct; u++)
+            {
+                const line& l = scene.lines[u];
+                const size_t exact = irm.querySize(l);
+                if(cache.querySize(l) != exact || cache.querySize(l) != exact || cache.query(l).size() != exact)
+                    throw std::runtime_error("cache suite: a cached result differs from the IRM after " + name);
+            }
+        }
+    }
+
+    Record r = acc.finish("cache", cached ? "cached" : "irm", o.trials);
+    r.params.push_back(std::make_pair(std::string("distinct"), (double)(distinct)));
+
+    if(cached)
+    {
+        r.extra.push_back(std::make_pair(std::string("hit_rate"), stats.hitRate()));
+        r.extra.push_back(std::make_pair(std::string("hit_ns"), stats.hits == 0 ? 0.0 : (double)(stats.hitTime) / (double)(stats.hits)));
+        r.extra.push_back(std::make_pair(std::string("miss_ns"), stats.misses == 0 ? 0.0 : (double)(stats.missTime) / (double)(stats.misses)));
+    }
+    return r;
+}
+
+void suiteCache(const Options& o, std::vector<Record>& out)
+{
+    for(double share : sweep(o, 0.1, 1.0, 0.3))
+    {
+        const size_t distinct = std::max((size_t)(1), std::min((size_t)(o.lines), (size_t)(std::llround(share * (double)(o.lines)))));
+
+        out.push_back(with(measureCache(o, distinct, false), o));
+        out.push_back(with(measureCache(o, distinct, true), o));
+    }
+}
+
+#ifdef IRM_PAGED
+/* Disk backed buckets */
+void suitePaged(const Options& o, std::vector<Record>& out)
+{
+    out.push_back(with(measure<IRMIndex<>>(o, "paged", "irm"), o));
+
+    for(double b : sweep(o, 0.1, 1.0, 0.1))
+    {
+        Options c = o;
+        c.budget = b;
+
+        Record r = with(measure<PagedIndex>(c, "paged", "paged"), c);
+        r.params.push_back(std::make_pair(std::string("budget"), b));
+        out.push_back(r);
+    }
+}
+#endif
+
+#ifdef IRM_SERVER
+/* Query server */
+
+// Queries per frame and frames a client keeps in flight
+static const size_t SERVER_FRAME = 16;
+static const size_t SERVER_DEPTH = 8;
+
+// A QueryServer with o.threads workers serves one IRM over a Unix socket to
+// `clients` client threads, each sending all lines from its own offset and
+// keeping SERVER_DEPTH frames in flight. Latency runs from sending a frame
+// to receiving the reply of each of its queries.
+static Record measureServer(const Options& o, unsigned int clients)
+{
+    Trials acc;
+    Histogram latency;
+    double batches = 0.0, queries = 0.0;
+
+    const char* dir = std::getenv("TMPDIR");
+    const std::string path = std::string(dir ? dir : "/tmp") + "/irm-server-" + std::to_string(::getpid()) + ".sock";
+
+    for(unsigned int trial = 0; trial < o.trials; trial++)
+    {
+        Scene scene(o, trial);
+
+        unsigned long int start = now();
+        std::shared_ptr<IRM> index = std::make_shared<IRM>(o.k, scene.segments);
+        acc.build += now() - start;
+        acc.bytes += index->statistics().bytes();
+
+        for(const line& l : scene.warmup)
+            acc.warmHits += index->querySize(l);
+
+        QueryServer<IRM> server(index, o.threads);
+        std::string error;
+        if(!server.start(path, error))
+            throw std::runtime_error(error);
+
+        std::vector<Histogram> latencies(clients);
+        std::vector<size_t> hits(clients, 0);
+        std::vector<std::thread> pool;
+        start = now();
+
+        for(unsigned int c = 0; c < clients; c++)
+        {
+            pool.push_back(std::thread([&, c]()
+            {
+                QueryClient client;
+                std::string e;
+                if(!client.connect(path, e))
+                    return;
+
+                const size_t lines = scene.lines.size();
+                const size_t frames = (lines + SERVER_FRAME - 1) / SERVER_FRAME;
+                std::vector<unsigned long int> sent(frames);
+                std::vector<line> frame;
+                std::vector<wire::Reply> replies;
+
+                size_t next = 0, outstanding = 0;
+                while(next < frames || outstanding != 0)
+                {
+                    if(next < frames && outstanding < SERVER_DEPTH * SERVER_FRAME)
+                    {
+                        frame.clear();
+                        for(size_t q = next * SERVER_FRAME; q < std::min(lines, (next + 1) * SERVER_FRAME); q++)
+                            frame.push_back(scene.lines[(q + lines * c / clients) % lines]);
+
+                        sent[next] = now();
+                        if(!client.send(frame, (uint32_t)(next * SERVER_FRAME)))
+                            return;
+
+                        outstanding += frame.size();
+                        next++;
+                        continue;
+                    }
+
+                    if(!client.receive(replies))
+                        return;
+
+                    const unsigned long int received = now();
+                    for(const wire::Reply& r : replies)
+                    {
+                        latencies[c].record(received - sent[r.id / SERVER_FRAME]);
+                        hits[c] += r.hits;
+                    }
+                    outstanding -= replies.size();
+                }
+            }));
+        }
+
+        for(std::thread& t : pool)
+            t.join();
+
+        acc.queryTime += now() - start;
+
+        const QueryServer<IRM>::Stats s = server.statistics();
+        batches += (double)(s.batches);
+        queries += (double)(s.queries);
+        server.stop();
+
+        for(unsigned int c = 0; c < clients; c++)
+        {
+            latency += latencies[c];
+            acc.hits += hits[c];
+        }
+    }
+
+    Record r = acc.finish("server", "irm", o.trials);
+    r.query = Summary::of(latency);
+    r.hits = latency.count() == 0 ? 0.0 : (double)(acc.hits) / (double)(latency.count());
+    r.throughput = acc.queryTime == 0 ? 0.0 : (double)(latency.count()) / BIL(acc.queryTime);
+    r.extra.push_back(std::make_pair(std::string("clients"), (double)(clients)));
+    r.extra.push_back(std::make_pair(std::string("batch"), batches == 0.0 ? 0.0 : queries / batches));
+    return r;
+}
+
+void suiteServer(const Options& o, std::vector<Record>& out)
+{
+    for(double c : sweep(o, 1.0, 8.0, 1.0))
+        out.push_back(with(measureServer(o, (unsigned int)(c)), o));
+}
+#endif